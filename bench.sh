@@ -0,0 +1,138 @@
+#!/bin/bash
+#
+# Benchmark matrix: runs every given allocator binary over every trace
+# a number of times and writes one row per run, as CSV or JSON. The
+# binaries are run with -b and their summary line is taken apart, see
+# "make bench". Runs that fail get status "fail", runs that take longer
+# than the timeout (kma_rm loops on some traces) get status "timeout";
+# both have empty values in the columns of the run. The last columns
+# hold the peak live bytes of the trace and the pages of the bound and
+# the offline placement of kma_bound, computed once per trace and
+# filled in whether the run passed or not.
+#
+
+COLUMNS="ops seconds ops_per_sec p50_ns p90_ns p99_ns p999_ns max_ns malloc_p99_ns free_p99_ns peak_pages waste_ratio pages_requested pages_freed";
+BOUND_COLUMNS="peak_live bound_pages offline_pages";
+
+REPS=3;
+TIMEOUT=60;
+FORMAT=csv;
+ARGS=;
+OUT=/dev/stdout;
+BOUND=${BENCH_BOUND:-./kma_bound};
+
+function usage()
+{
+	echo "usage: $0 [-r reps] [-f csv|json] [-a harnessOptions] [-T seconds] [-o file] program...";
+	echo "runs every program over \${BENCH_TRACES} (default testsuite/*.trace)";
+	exit 1;
+}
+
+# prints a row from the summary line of a run, empty if it failed, and
+# the bound line of its trace
+function row()
+{
+	echo "$5"$'\n'"$6" | awk -v runcols="${COLUMNS}" \
+		-v boundcols="${BOUND_COLUMNS}" -v format=${FORMAT} \
+		-v backend="$1" -v trace="$2" -v rep="$3" -v status="$4" '
+	$1 == "Summary:" || $1 == "Bound:" {
+		for (i = 2; i <= NF; i++) {
+			split($i, kv, "=");
+			val[$1, kv[1]] = kv[2];
+		}
+	}
+	END {
+		n = split(runcols, c, " ");
+		for (i = 1; i <= n; i++) {
+			col[i] = c[i];
+			v[i] = val["Summary:", c[i]];
+		}
+		m = split(boundcols, c, " ");
+		for (i = 1; i <= m; i++) {
+			col[n + i] = c[i];
+			v[n + i] = val["Bound:", c[i]];
+		}
+		n += m;
+		if (format == "csv") {
+			line = backend "," trace "," rep "," status;
+			for (i = 1; i <= n; i++)
+				line = line "," v[i];
+		} else {
+			line = "  {\"backend\": \"" backend "\", \"trace\": \"" trace "\", \"rep\": " rep ", \"status\": \"" status "\"";
+			for (i = 1; i <= n; i++)
+				line = line ", \"" col[i] "\": " (v[i] != "" ? v[i] : "null");
+			line = line "}";
+		}
+		print line;
+	}';
+}
+
+while getopts "r:f:a:T:o:" opt; do
+	case ${opt} in
+	r) REPS=${OPTARG};;
+	f) FORMAT=${OPTARG};;
+	a) ARGS=${OPTARG};;
+	T) TIMEOUT=${OPTARG};;
+	o) OUT=${OPTARG};;
+	*) usage;;
+	esac;
+done;
+shift $((OPTIND - 1));
+
+if [[ $# -eq 0 || ( ${FORMAT} != csv && ${FORMAT} != json ) ]]; then
+	usage;
+fi;
+
+TRACES=${BENCH_TRACES:-testsuite/*.trace};
+
+# "trace Bound: ..." per trace
+BOUNDS=;
+if [[ -x ${BOUND} ]]; then
+	for trace in ${TRACES}; do
+		BOUNDS="${BOUNDS}${trace} `${BOUND} -b ${trace} 2>/dev/null`"$'\n';
+	done;
+fi;
+
+{
+	if [[ ${FORMAT} == csv ]]; then
+		echo "backend,trace,rep,status,${COLUMNS// /,},${BOUND_COLUMNS// /,}";
+	else
+		echo "[";
+	fi;
+
+	SEP=;
+	# whole passes over the matrix, so that drift of the machine shows
+	# up as spread between the reps instead of biasing one backend
+	for ((rep = 1; rep <= REPS; rep++)); do
+		for prog in "$@"; do
+			backend=`basename ${prog} _opt`;
+			for trace in ${TRACES}; do
+				output=`timeout ${TIMEOUT} ${prog} -b ${ARGS} ${trace} 2>/dev/null`;
+				case $? in
+				0) status=ok;;
+				124) status=timeout;;
+				*) status=fail;;
+				esac;
+				bound=`echo "${BOUNDS}" | grep "^${trace} Bound:" | cut -d' ' -f2-`;
+				summary=`echo "${output}" | grep "^Summary:"`;
+				if [[ ${status} == ok && -z ${summary} ]]; then
+					status=fail;
+				fi;
+				if [[ ${status} != ok ]]; then
+					summary=;
+				fi;
+				echo "${backend} `basename ${trace}` ${rep}: ${status}" >&2;
+
+				if [[ ${FORMAT} == json ]]; then
+					echo -n "${SEP}";
+					SEP=$',\n';
+				fi;
+				row ${backend} `basename ${trace}` ${rep} ${status} "${summary}" "${bound}";
+			done;
+		done;
+	done;
+
+	if [[ ${FORMAT} == json ]]; then
+		echo "]";
+	fi;
+} > ${OUT};
@@ -0,0 +1,611 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Thread-scaling benchmark for the kernel memory allocator
+ ***************************************************************************/
+#define __KMA_TEST_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_hist.h"
+#ifdef KMA_TCACHE
+#include "kma_tcache.h"
+#endif
+#ifdef KMA_MAGAZINE
+#include "kma_magazine.h"
+#endif
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Every scenario runs for about BENCH_OPS mallocs and frees per thread
+ * (-n) with request sizes uniform in [MINSIZE, MAXSIZE]. The live set
+ * of a thread stays below 300 KB, so 64 threads fit into the pool. */
+#define BENCH_OPS 200000
+#define MINSIZE 16
+#define MAXSIZE 512
+#define MAXTHREADS 256
+
+// churn: random replacements in a private array of slots
+#define CHURN_SLOTS 256
+
+// prodcons: batches are handed to the next thread, which frees them
+#define PC_BATCH 64
+#define PC_BATCHES 4
+
+// burst: all threads allocate, then each frees its neighbour's objects
+#define BURST_OBJECTS 512
+
+// larson: generations of threads inherit their predecessors' slots
+#define LARSON_SLOTS 512
+#define LARSON_GENERATIONS 8
+
+#if defined(KMA_TCACHE)
+#define BACKEND_NAME "KMA_TCACHE"
+#elif defined(KMA_MAGAZINE)
+#define BACKEND_NAME "KMA_MAGAZINE"
+#elif defined(KMA_DUMMY)
+#define BACKEND_NAME "KMA_DUMMY"
+#elif defined(KMA_RM)
+#define BACKEND_NAME "KMA_RM"
+#elif defined(KMA_BUD)
+#define BACKEND_NAME "KMA_BUD"
+#elif defined(KMA_WBUD)
+#define BACKEND_NAME "KMA_WBUD"
+#else
+#define BACKEND_NAME "unknown"
+#endif
+
+typedef struct batch
+{
+  struct batch* next;
+  int owner;
+  void* ptr[PC_BATCH];
+  kma_size_t size[PC_BATCH];
+} batch_t;
+
+typedef struct
+{
+  void* ptr;
+  kma_size_t size;
+} object_t;
+
+typedef struct bench_thread
+{
+  pthread_t thread;
+  int id;
+  unsigned int seed;
+  kma_hist_t hist;	// every call, in ticks
+  object_t* slots;	// larson
+  batch_t* inbox;	// prodcons, pushed by the previous thread
+  batch_t* empty;	// prodcons, batches handed back by the next one
+} bench_thread_t;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int count;
+  int waiting;
+  int generation;
+} barrier_t;
+
+typedef struct
+{
+  char* name;
+  void* (*run)(void*);
+} scenario_t;
+
+/************Global Variables*********************************************/
+
+static int gThreads;
+static long long gOps = BENCH_OPS;
+
+static bench_thread_t gThread[MAXTHREADS];
+
+static barrier_t gBarrier;
+
+static object_t gBurst[MAXTHREADS][BURST_OBJECTS];
+static object_t gLarson[MAXTHREADS][LARSON_SLOTS];
+static int gGeneration;
+
+#ifndef KMA_FRONTEND
+// the plain backends are not thread-safe and get serialized
+static pthread_mutex_t gKmaLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/************Function Prototypes******************************************/
+void* churn(void*);
+void* prodcons(void*);
+void* burst(void*);
+void* larson(void*);
+void runScenario(scenario_t*, int);
+void* timedMalloc(bench_thread_t*, kma_size_t);
+void timedFree(bench_thread_t*, void*, kma_size_t);
+kma_size_t randomSize(bench_thread_t*);
+void pushBatch(batch_t**, batch_t*);
+batch_t* takeBatches(batch_t**);
+void barrierInit(barrier_t*, int);
+void barrierWait(barrier_t*);
+long long now();
+void usage();
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+static scenario_t kScenarios[] =
+  {
+    { "churn",    churn    },
+    { "prodcons", prodcons },
+    { "burst",    burst    },
+    { "larson",   larson   },
+    { NULL,       NULL     }
+  };
+
+char *name = NULL;
+
+int
+main(int argc, char* argv[])
+{
+  kma_page_stat_t* stat;
+  scenario_t* scenario;
+  char* only = NULL;
+  int maxThreads, threads, found, opt;
+
+  name = argv[0];
+
+  maxThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  while ((opt = getopt(argc, argv, "t:n:s:")) != -1)
+    {
+      switch (opt)
+	{
+	case 't':
+	  maxThreads = atoi(optarg);
+	  break;
+	case 'n':
+	  gOps = atoll(optarg);
+	  break;
+	case 's':
+	  only = optarg;
+	  break;
+	default:
+	  usage();
+	}
+    }
+
+  if (optind != argc || maxThreads < 1 || gOps < 1)
+    {
+      usage();
+    }
+  if (maxThreads > MAXTHREADS)
+    {
+      maxThreads = MAXTHREADS;
+    }
+
+  printf("%-14s %-10s %7s %14s %10s\n",
+	 "backend", "scenario", "threads", "ops/sec", "p99 (ns)");
+
+  found = 0;
+  for (scenario = kScenarios; scenario->name != NULL; scenario++)
+    {
+      if (only != NULL && strcmp(only, scenario->name) != 0)
+	{
+	  continue;
+	}
+      found = 1;
+
+      for (threads = 1; threads <= maxThreads; threads++)
+	{
+	  runScenario(scenario, threads);
+	}
+    }
+
+  if (!found)
+    {
+      error("unknown scenario", only);
+    }
+
+#ifdef KMA_TCACHE
+  kma_tcache_flush();
+#endif
+#ifdef KMA_MAGAZINE
+  kma_magazine_flush();
+#endif
+
+  stat = page_stats();
+  if (stat->num_in_use != 0)
+    {
+      error("not all pages freed", "");
+    }
+
+  return 0;
+}
+
+void
+runScenario(scenario_t* scenario, int threads)
+{
+  kma_hist_t total;
+  long long start, elapsed;
+  int t;
+
+  gThreads = threads;
+  barrierInit(&gBarrier, threads);
+
+  for (t = 0; t < threads; t++)
+    {
+      memset(&gThread[t], 0, sizeof(bench_thread_t));
+      gThread[t].id = t;
+      gThread[t].seed = t + 1;
+    }
+
+  start = now();
+  if (scenario->run == larson)
+    {
+      // every generation starts fresh threads on shifted slot arrays
+      for (gGeneration = 0; gGeneration < LARSON_GENERATIONS; gGeneration++)
+	{
+	  for (t = 0; t < threads; t++)
+	    {
+	      gThread[t].slots = gLarson[(t + gGeneration) % threads];
+	      pthread_create(&gThread[t].thread, NULL, larson, &gThread[t]);
+	    }
+	  for (t = 0; t < threads; t++)
+	    {
+	      pthread_join(gThread[t].thread, NULL);
+	    }
+	}
+    }
+  else
+    {
+      for (t = 0; t < threads; t++)
+	{
+	  pthread_create(&gThread[t].thread, NULL, scenario->run, &gThread[t]);
+	}
+      for (t = 0; t < threads; t++)
+	{
+	  pthread_join(gThread[t].thread, NULL);
+	}
+    }
+  elapsed = now() - start;
+
+  memset(&total, 0, sizeof(total));
+  for (t = 0; t < threads; t++)
+    {
+      hist_merge(&total, &gThread[t].hist);
+      hist_free(&gThread[t].hist);
+    }
+
+  printf("%-14s %-10s %7d %14.0f %10.0f\n", BACKEND_NAME, scenario->name,
+	 threads, elapsed > 0 ? total.count * 1e9 / elapsed : 0.0,
+	 hist_ns(hist_percentile(&total, 0.99)));
+  fflush(stdout);
+  hist_free(&total);
+}
+
+void*
+churn(void* arg)
+{
+  bench_thread_t* self = (bench_thread_t*) arg;
+  object_t slots[CHURN_SLOTS];
+  object_t* slot;
+  long long i;
+
+  memset(slots, 0, sizeof(slots));
+
+  for (i = 0; i < gOps; i++)
+    {
+      slot = &slots[rand_r(&self->seed) % CHURN_SLOTS];
+      if (slot->ptr != NULL)
+	{
+	  timedFree(self, slot->ptr, slot->size);
+	  slot->ptr = NULL;
+	}
+      else
+	{
+	  slot->size = randomSize(self);
+	  slot->ptr = timedMalloc(self, slot->size);
+	}
+    }
+
+  for (i = 0; i < CHURN_SLOTS; i++)
+    {
+      if (slots[i].ptr != NULL)
+	{
+	  timedFree(self, slots[i].ptr, slots[i].size);
+	}
+    }
+
+  return NULL;
+}
+
+void*
+prodcons(void* arg)
+{
+  bench_thread_t* self = (bench_thread_t*) arg;
+  bench_thread_t* next = &gThread[(self->id + 1) % gThreads];
+  batch_t* spare = NULL;
+  batch_t* full;
+  batch_t* batch;
+  long long quota = gOps / (2 * PC_BATCH) + 1;
+  long long produced = 0, consumed = 0;
+  int i;
+
+  for (i = 0; i < PC_BATCHES; i++)
+    {
+      batch = malloc(sizeof(batch_t));
+      assert(batch != NULL);
+      batch->owner = self->id;
+      batch->next = spare;
+      spare = batch;
+    }
+
+  // the previous thread produces as many batches as we do
+  while (produced < quota || consumed < quota)
+    {
+      full = takeBatches(&self->inbox);
+      while (full != NULL)
+	{
+	  batch = full;
+	  full = full->next;
+	  for (i = 0; i < PC_BATCH; i++)
+	    {
+	      timedFree(self, batch->ptr[i], batch->size[i]);
+	    }
+	  pushBatch(&gThread[batch->owner].empty, batch);
+	  consumed++;
+	}
+
+      if (produced == quota)
+	{
+	  sched_yield();
+	  continue;
+	}
+
+      if (spare == NULL)
+	{
+	  spare = takeBatches(&self->empty);
+	  if (spare == NULL)
+	    {
+	      sched_yield();
+	      continue;
+	    }
+	}
+
+      batch = spare;
+      spare = spare->next;
+      for (i = 0; i < PC_BATCH; i++)
+	{
+	  batch->size[i] = randomSize(self);
+	  batch->ptr[i] = timedMalloc(self, batch->size[i]);
+	}
+      pushBatch(&next->inbox, batch);
+      produced++;
+    }
+
+  // wait for the last of our batches to come back
+  for (i = 0; i < PC_BATCHES; )
+    {
+      batch = takeBatches(&self->empty);
+      if (batch == NULL)
+	{
+	  batch = spare;
+	  spare = NULL;
+	}
+      if (batch == NULL)
+	{
+	  sched_yield();
+	  continue;
+	}
+      while (batch != NULL)
+	{
+	  full = batch->next;
+	  free(batch);
+	  batch = full;
+	  i++;
+	}
+    }
+
+  return NULL;
+}
+
+void*
+burst(void* arg)
+{
+  bench_thread_t* self = (bench_thread_t*) arg;
+  object_t* mine = gBurst[self->id];
+  object_t* theirs = gBurst[(self->id + 1) % gThreads];
+  long long rounds = gOps / (2 * BURST_OBJECTS) + 1;
+  long long r;
+  int i;
+
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = 0; i < BURST_OBJECTS; i++)
+	{
+	  mine[i].size = randomSize(self);
+	  mine[i].ptr = timedMalloc(self, mine[i].size);
+	}
+      barrierWait(&gBarrier);
+
+      for (i = 0; i < BURST_OBJECTS; i++)
+	{
+	  timedFree(self, theirs[i].ptr, theirs[i].size);
+	}
+      barrierWait(&gBarrier);
+    }
+
+  return NULL;
+}
+
+void*
+larson(void* arg)
+{
+  bench_thread_t* self = (bench_thread_t*) arg;
+  object_t* slot;
+  long long i;
+
+  // most of the slots were filled by another thread
+  for (i = 0; i < gOps / LARSON_GENERATIONS; i++)
+    {
+      slot = &self->slots[rand_r(&self->seed) % LARSON_SLOTS];
+      if (slot->ptr != NULL)
+	{
+	  timedFree(self, slot->ptr, slot->size);
+	}
+      slot->size = randomSize(self);
+      slot->ptr = timedMalloc(self, slot->size);
+    }
+
+  if (gGeneration == LARSON_GENERATIONS - 1)
+    {
+      for (i = 0; i < LARSON_SLOTS; i++)
+	{
+	  slot = &self->slots[i];
+	  if (slot->ptr != NULL)
+	    {
+	      timedFree(self, slot->ptr, slot->size);
+	      slot->ptr = NULL;
+	    }
+	}
+    }
+
+  return NULL;
+}
+
+void*
+timedMalloc(bench_thread_t* self, kma_size_t size)
+{
+  uint64_t start;
+  void* ptr;
+
+  start = hist_ticks();
+#ifndef KMA_FRONTEND
+  pthread_mutex_lock(&gKmaLock);
+  ptr = kma_malloc(size);
+  pthread_mutex_unlock(&gKmaLock);
+#else
+  ptr = kma_malloc(size);
+#endif
+  hist_record(&self->hist, hist_ticks() - start);
+
+  if (ptr == NULL)
+    {
+      error("got NULL from kma_malloc", "");
+    }
+  return ptr;
+}
+
+void
+timedFree(bench_thread_t* self, void* ptr, kma_size_t size)
+{
+  uint64_t start;
+
+  start = hist_ticks();
+#ifndef KMA_FRONTEND
+  pthread_mutex_lock(&gKmaLock);
+  kma_free(ptr, size);
+  pthread_mutex_unlock(&gKmaLock);
+#else
+  kma_free(ptr, size);
+#endif
+  hist_record(&self->hist, hist_ticks() - start);
+}
+
+kma_size_t
+randomSize(bench_thread_t* self)
+{
+  return MINSIZE + rand_r(&self->seed) % (MAXSIZE - MINSIZE + 1);
+}
+
+void
+pushBatch(batch_t** stack, batch_t* batch)
+{
+  batch->next = __atomic_load_n(stack, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(stack, &batch->next, batch, 1,
+				      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+batch_t*
+takeBatches(batch_t** stack)
+{
+  if (__atomic_load_n(stack, __ATOMIC_RELAXED) == NULL)
+    {
+      return NULL;
+    }
+  return __atomic_exchange_n(stack, NULL, __ATOMIC_ACQUIRE);
+}
+
+void
+barrierInit(barrier_t* barrier, int count)
+{
+  pthread_mutex_init(&barrier->lock, NULL);
+  pthread_cond_init(&barrier->cond, NULL);
+  barrier->count = count;
+  barrier->waiting = 0;
+  barrier->generation = 0;
+}
+
+void
+barrierWait(barrier_t* barrier)
+{
+  int generation;
+
+  pthread_mutex_lock(&barrier->lock);
+  generation = barrier->generation;
+  if (++barrier->waiting == barrier->count)
+    {
+      barrier->waiting = 0;
+      barrier->generation++;
+      pthread_cond_broadcast(&barrier->cond);
+    }
+  else
+    {
+      while (generation == barrier->generation)
+	{
+	  pthread_cond_wait(&barrier->cond, &barrier->lock);
+	}
+    }
+  pthread_mutex_unlock(&barrier->lock);
+}
+
+long long
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void
+usage()
+{
+  printf("Usage: %s [-t maxThreads] [-n opsPerThread] [-s scenario]\n", name);
+  printf("Scenarios: churn prodcons burst larson\n");
+  exit(0);
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
@@ -0,0 +1,507 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Offline bounds on the pages a trace needs
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "kma_page.h"
+#include "kma_trace.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Every request is a block with a lifetime [start, end) in ops, in the
+ * order of the starts. Blocks that are never freed live to the end. */
+typedef struct
+{
+  long start;
+  long end;
+  size_t offset;	// from the placement
+  int size;
+} block_t;
+
+// a free range of the arena below its top
+typedef struct
+{
+  size_t offset;
+  size_t size;
+} hole_t;
+
+#define NO_BLOCK (-1)
+
+/************Global Variables*********************************************/
+
+static block_t* gBlocks = NULL;
+static long gNumBlocks = 0;
+static long gNumOps = 0;
+
+// per op: block + 1 when it starts, -(block + 1) when it ends
+static long* gOps = NULL;
+
+// the holes of the placement, by offset, coalesced
+static hole_t* gHoles = NULL;
+static long gNumHoles = 0;
+static long gMaxHoles = 0;
+
+/* The arena up to its top, and per offset the live block that starts
+ * and that ends there, NO_BLOCK if none */
+static size_t gTop = 0;
+static size_t gMaxTop = 0;
+static int* gStartsAt = NULL;
+static int* gEndsAt = NULL;
+
+/************Function Prototypes******************************************/
+void readTrace(char*, long*, long*);
+void place();
+size_t placeBlock(long);
+void freeBlock(long);
+int closerEnd(long, long, long);
+void growArena(size_t);
+void insertHole(long, size_t, size_t);
+void removeHole(long);
+long peakPages(size_t*);
+void usage();
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+char *name = NULL;
+
+int
+main(int argc, char* argv[])
+{
+  long peakLive, peakOp, bound;
+  long pages = -1;
+  size_t arena = 0;
+  int summary = 0;
+  int opt;
+
+  name = argv[0];
+
+  while ((opt = getopt(argc, argv, "b")) != -1)
+    {
+      switch (opt)
+	{
+	case 'b':
+	  summary = 1;
+	  break;
+	default:
+	  usage();
+	}
+    }
+
+  if (optind != argc - 1)
+    {
+      usage();
+    }
+
+  readTrace(argv[optind], &peakLive, &peakOp);
+  bound = (peakLive + PAGESIZE - 1) / PAGESIZE;
+
+  place();
+  pages = peakPages(&arena);
+
+  if (summary)
+    {
+      printf("Bound: ops=%ld requests=%ld peak_live=%ld bound_pages=%ld "
+	     "offline_pages=%ld arena_pages=%ld\n", gNumOps, gNumBlocks,
+	     peakLive, bound, pages, (long)((arena + PAGESIZE - 1) / PAGESIZE));
+      return 0;
+    }
+
+  printf("Trace: %ld ops, %ld requests\n", gNumOps, gNumBlocks);
+  printf("Peak live bytes: %ld (after op %ld)\n", peakLive, peakOp);
+  printf("Lower bound: %ld pages\n", bound);
+  printf("Offline placement: %ld pages at peak, in an arena of %ld pages\n",
+	 pages, (long)((arena + PAGESIZE - 1) / PAGESIZE));
+  return 0;
+}
+
+/* Reads the lifetimes of all requests, and the peak of the bytes live
+ * at once, which no allocator can fit into fewer pages. */
+void
+readTrace(char* path, long* peakLive, long* peakOp)
+{
+  trace_t* trace = trace_open(path);
+  trace_op_t op;
+  long* current;	// block of each live id, -1 if none
+  long numIds = trace_ids(trace);
+  long maxBlocks = 1024, maxOps = 1024;
+  long live = 0;
+  long i;
+
+  current = malloc(numIds * sizeof(long) + sizeof(long));
+  gBlocks = malloc(maxBlocks * sizeof(block_t));
+  gOps = malloc(maxOps * sizeof(long));
+  if (current == NULL || gBlocks == NULL || gOps == NULL)
+    {
+      error("out of memory reading", path);
+    }
+  memset(current, -1, numIds * sizeof(long));
+
+  *peakLive = 0;
+  *peakOp = 0;
+
+  while (trace_next(trace, &op))
+    {
+      if (op.id < 0 || op.id >= numIds)
+	{
+	  error("request id out of range", path);
+	}
+      if (gNumOps == maxOps)
+	{
+	  maxOps *= 2;
+	  gOps = realloc(gOps, maxOps * sizeof(long));
+	  if (gOps == NULL)
+	    {
+	      error("out of memory reading", path);
+	    }
+	}
+
+      if (op.type == TRACE_REQUEST)
+	{
+	  if (current[op.id] >= 0)
+	    {
+	      error("REQUEST of a request that is allocated", path);
+	    }
+	  if (gNumBlocks == maxBlocks)
+	    {
+	      maxBlocks *= 2;
+	      gBlocks = realloc(gBlocks, maxBlocks * sizeof(block_t));
+	      if (gBlocks == NULL)
+		{
+		  error("out of memory reading", path);
+		}
+	    }
+	  gBlocks[gNumBlocks].start = gNumOps;
+	  gBlocks[gNumBlocks].end = -1;
+	  gBlocks[gNumBlocks].offset = 0;
+	  gBlocks[gNumBlocks].size = op.size;
+	  current[op.id] = gNumBlocks;
+	  gOps[gNumOps] = gNumBlocks + 1;
+	  gNumBlocks++;
+
+	  live += op.size;
+	  if (live > *peakLive)
+	    {
+	      *peakLive = live;
+	      *peakOp = gNumOps + 1;
+	    }
+	}
+      else
+	{
+	  if (current[op.id] < 0)
+	    {
+	      error("FREE of a request that is not allocated", path);
+	    }
+	  gBlocks[current[op.id]].end = gNumOps;
+	  gOps[gNumOps] = -(current[op.id] + 1);
+	  live -= gBlocks[current[op.id]].size;
+	  current[op.id] = -1;
+	}
+      gNumOps++;
+    }
+
+  for (i = 0; i < gNumBlocks; i++)
+    {
+      if (gBlocks[i].end < 0)
+	{
+	  gBlocks[i].end = gNumOps;
+	}
+    }
+
+  free(current);
+  trace_close(trace);
+}
+
+/* Offline placement: knowing all lifetimes, the blocks are placed in
+ * the order of the trace, each into the smallest hole that fits it, or
+ * else at the top of the arena. Of a larger hole a block takes the end
+ * next to the neighbour whose end is closest to its own, so that the
+ * two tend to be freed into one hole. This is an achievable layout, so
+ * the optimum lies between the lower bound and its pages. */
+void
+place()
+{
+  long i;
+
+  for (i = 0; i < gNumOps; i++)
+    {
+      if (gOps[i] > 0)
+	{
+	  gBlocks[gOps[i] - 1].offset = placeBlock(gOps[i] - 1);
+	}
+      else
+	{
+	  freeBlock(-gOps[i] - 1);
+	}
+    }
+}
+
+size_t
+placeBlock(long b)
+{
+  size_t size = gBlocks[b].size;
+  size_t offset;
+  hole_t* hole;
+  long best = -1;
+  long i;
+
+  if (size == 0)
+    {
+      return 0;
+    }
+
+  for (i = 0; i < gNumHoles; i++)
+    {
+      if (gHoles[i].size >= size
+	  && (best < 0 || gHoles[i].size < gHoles[best].size))
+	{
+	  best = i;
+	}
+    }
+
+  if (best < 0)
+    {
+      // a hole at the top grows with the arena
+      offset = gTop;
+      if (gNumHoles > 0
+	  && gHoles[gNumHoles - 1].offset + gHoles[gNumHoles - 1].size == gTop)
+	{
+	  offset = gHoles[gNumHoles - 1].offset;
+	  removeHole(gNumHoles - 1);
+	}
+      growArena(offset + size);
+    }
+  else
+    {
+      hole = &gHoles[best];
+      hole->size -= size;
+      if (closerEnd(gStartsAt[hole->offset + hole->size + size],
+		    gEndsAt[hole->offset], b))
+	{
+	  offset = hole->offset + hole->size;
+	}
+      else
+	{
+	  offset = hole->offset;
+	  hole->offset += size;
+	}
+      if (hole->size == 0)
+	{
+	  removeHole(best);
+	}
+    }
+
+  gStartsAt[offset] = b;
+  gEndsAt[offset + size] = b;
+  return offset;
+}
+
+void
+freeBlock(long b)
+{
+  size_t offset = gBlocks[b].offset;
+  size_t size = gBlocks[b].size;
+  long lo = 0, hi = gNumHoles, mid;
+
+  if (size == 0)
+    {
+      return;
+    }
+  if (gStartsAt[offset] == b)
+    {
+      gStartsAt[offset] = NO_BLOCK;
+    }
+  if (gEndsAt[offset + size] == b)
+    {
+      gEndsAt[offset + size] = NO_BLOCK;
+    }
+
+  // the first hole above the block
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (gHoles[mid].offset < offset)
+	{
+	  lo = mid + 1;
+	}
+      else
+	{
+	  hi = mid;
+	}
+    }
+
+  if (lo > 0 && gHoles[lo - 1].offset + gHoles[lo - 1].size == offset)
+    {
+      gHoles[lo - 1].size += size;
+      if (lo < gNumHoles && offset + size == gHoles[lo].offset)
+	{
+	  gHoles[lo - 1].size += gHoles[lo].size;
+	  removeHole(lo);
+	}
+    }
+  else if (lo < gNumHoles && offset + size == gHoles[lo].offset)
+    {
+      gHoles[lo].offset = offset;
+      gHoles[lo].size += size;
+    }
+  else
+    {
+      insertHole(lo, offset, size);
+    }
+}
+
+// whether block b ends closer to the one above it than below it
+int
+closerEnd(long above, long below, long b)
+{
+  if (above == NO_BLOCK)
+    {
+      return 0;
+    }
+  if (below == NO_BLOCK)
+    {
+      return 1;
+    }
+  return labs(gBlocks[above].end - gBlocks[b].end)
+    < labs(gBlocks[below].end - gBlocks[b].end);
+}
+
+void
+growArena(size_t top)
+{
+  size_t maxTop = (gMaxTop > 0) ? gMaxTop : PAGESIZE;
+
+  gTop = top;
+  if (top < gMaxTop)
+    {
+      return;
+    }
+
+  while (maxTop <= top)
+    {
+      maxTop *= 2;
+    }
+  gStartsAt = realloc(gStartsAt, maxTop * sizeof(int));
+  gEndsAt = realloc(gEndsAt, maxTop * sizeof(int));
+  if (gStartsAt == NULL || gEndsAt == NULL)
+    {
+      error("out of memory placing", "");
+    }
+  memset(gStartsAt + gMaxTop, NO_BLOCK, (maxTop - gMaxTop) * sizeof(int));
+  memset(gEndsAt + gMaxTop, NO_BLOCK, (maxTop - gMaxTop) * sizeof(int));
+  gMaxTop = maxTop;
+}
+
+void
+insertHole(long i, size_t offset, size_t size)
+{
+  if (gNumHoles == gMaxHoles)
+    {
+      gMaxHoles = (gMaxHoles > 0) ? 2 * gMaxHoles : 1024;
+      gHoles = realloc(gHoles, gMaxHoles * sizeof(hole_t));
+      if (gHoles == NULL)
+	{
+	  error("out of memory placing", "");
+	}
+    }
+  memmove(&gHoles[i + 1], &gHoles[i], (gNumHoles - i) * sizeof(hole_t));
+  gHoles[i].offset = offset;
+  gHoles[i].size = size;
+  gNumHoles++;
+}
+
+void
+removeHole(long i)
+{
+  memmove(&gHoles[i], &gHoles[i + 1], (gNumHoles - i - 1) * sizeof(hole_t));
+  gNumHoles--;
+}
+
+/* Replays the placement and returns the most pages that hold a live
+ * block at once, and the size of the whole arena */
+long
+peakPages(size_t* arena)
+{
+  int* count;
+  long pages = 0, peak = 0;
+  size_t numPages, first, last, p;
+  long i, b;
+
+  *arena = 0;
+  for (i = 0; i < gNumBlocks; i++)
+    {
+      if (gBlocks[i].offset + gBlocks[i].size > *arena)
+	{
+	  *arena = gBlocks[i].offset + gBlocks[i].size;
+	}
+    }
+
+  numPages = (*arena + PAGESIZE - 1) / PAGESIZE;
+  count = calloc(numPages + 1, sizeof(int));
+  if (count == NULL)
+    {
+      error("out of memory replaying the placement", "");
+    }
+
+  for (i = 0; i < gNumOps; i++)
+    {
+      b = (gOps[i] > 0) ? gOps[i] - 1 : -gOps[i] - 1;
+      if (gBlocks[b].size == 0)
+	{
+	  continue;
+	}
+      first = gBlocks[b].offset / PAGESIZE;
+      last = (gBlocks[b].offset + gBlocks[b].size - 1) / PAGESIZE;
+      for (p = first; p <= last; p++)
+	{
+	  if (gOps[i] > 0)
+	    {
+	      pages += (count[p]++ == 0);
+	    }
+	  else
+	    {
+	      pages -= (--count[p] == 0);
+	    }
+	}
+      if (pages > peak)
+	{
+	  peak = pages;
+	}
+    }
+
+  free(count);
+  return peak;
+}
+
+void
+usage()
+{
+  printf("Usage: %s [-b] traceFile\n", name);
+  printf("Prints the peak live bytes of a trace, the lower bound on the\n");
+  printf("pages it needs and the pages of an offline placement\n");
+  printf("  -b  print one line for benchmarks (see bench.sh)\n");
+  exit(0);
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
@@ -34,8 +34,10 @@
 #ifdef KMA_BUD
 #define __KMA_IMPL__
 #define MINBLOCKSIZE 32
-#define BITMAPSIZE PAGESIZE / MINBLOCKSIZE
+#define BITMAPSIZE (PAGESIZE / MINBLOCKSIZE)
 #define CHAR_BIT 8
+#define NUMORDERS 9	// block sizes 32, 64, ..., PAGESIZE
+#define ORDERSIZE(i) (MINBLOCKSIZE << (i))
 
 
 
@@ -54,10 +56,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/time.h>
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_instr.h"
+#include "kma_stats.h"
     
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps    *  Global variables begin with g. Global constants with k. Local
@@ -65,69 +68,74 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
- typedef struct free_list
+ // Free lists are doubly linked, and every free block records its
+ // size, so that a buddy can be found and unlinked without a search.
+ // The links are block numbers, page_index() * BITMAPSIZE + unit, and
+ // are kept with the page metadata, so a free block is never written
+ typedef struct free_link
  {
   int size;
-  struct free_list* nextFree;
- } free_block;
+  int nextFree;	// -1 at the ends of a list
+  int prevFree;
+ } free_link;
+
+ // Per-page metadata, kept out of band so that every page is fully
+ // available to the buddy system. bitmap marks the allocated 32-byte
+ // units, heads the first unit of every allocated block, and links
+ // holds the links of the free block starting at each unit.
+ typedef struct page_meta
+ {
+  kma_page_t* page;
+  unsigned char bitmap[BITMAPSIZE / CHAR_BIT];
+  unsigned char heads[BITMAPSIZE / CHAR_BIT];
+  free_link links[BITMAPSIZE];
+ } page_meta;
 
 /************Global Variables*********************************************/
 
- static kma_page_t* pageHeader = NULL;
- size_t totalRequested = 0;
- size_t totalNeeded = 8192;
- int mallocCounter = 0;
- int freeCounter = 0;
- int averageMallocTime = 0;
- int averageFreeTime = 0;
- int totalMallocTime = 0;
- int totalFreeTime = 0;
- int worstMallocTime = 0;
- int worstFreeTime = 0;
+ static int freeList[NUMORDERS];	// first block of each order, -1 if none
+ static int freeListReady = 0;
+ static page_meta* pageMeta = NULL;	// page_table(), MAXPAGES entries
+ static kma_stats_t gStats;
 
 /************Function Prototypes******************************************/
   
 /************External Declaration*****************************************/
 
 /**************Implementation***********************************************/
-kma_size_t power(int base, int exp) {
-  int i;
-  int ret = 1;
-  if (exp == 0) {
-    return 1;
-  }
-  for (i = 0; i < exp; i++) {
-    ret = base * ret;
+kma_size_t roundToPowerOfTwo(kma_size_t size) {
+  kma_size_t block = MINBLOCKSIZE;
+  while (block < size && block < PAGESIZE) {
+    block <<= 1;
   }
-  return (kma_size_t) ret;
+  return (size <= block) ? block : size;
 }
 
+void initializeFreeList() {
+  int i = 0;
+  for (i=0; i < NUMORDERS; i++) {
+  freeList[i] = -1;
+  }
+  if (pageMeta == NULL) {
+    pageMeta = page_table(sizeof(page_meta));
+  }
+  freeListReady = 1;
+}
 
+page_meta* getPageMeta(void* ptr) {
+  return &pageMeta[page_index(ptr)];
+}
 
-kma_size_t roundToPowerOfTwo(kma_size_t size) {
-  int i;
-  for (i=0; i < 8; i++) {
-    if (size <= 32*power(2,i)) {
-      return 32 * power(2,i);
-    }
-  }
-  return size;
+int blockNumber(void* ptr) {
+  return page_index(ptr) * BITMAPSIZE + (ptr - BASEADDR(ptr)) / MINBLOCKSIZE;
 }
 
-void initializeFreeList() {
-  kma_page_t* freeListPage;
-  freeListPage = get_page();
-  *((kma_page_t**)freeListPage->ptr) = freeListPage;
-  
-  pageHeader = (kma_page_t*)freeListPage->ptr;
+void* blockAddress(int block) {
+  return pageMeta[block / BITMAPSIZE].page->ptr + (block % BITMAPSIZE) * MINBLOCKSIZE;
+}
 
-  // Place free list immediately after header
-  free_block* freeList = (free_block*)((void *)(pageHeader) + sizeof(kma_page_t));
-  int i = 0;
-  for (i=0; i < 8; i++) {
-  freeList[i].size = MINBLOCKSIZE*power(2, i);
-  freeList[i].nextFree = NULL;
-  }
+free_link* getLink(int block) {
+  return &pageMeta[block / BITMAPSIZE].links[block % BITMAPSIZE];
 }
 
 void set_nth_bit(unsigned char *bitmap, int idx) {
@@ -143,100 +151,137 @@ int get_nth_bit(unsigned char *bitmap, int idx) {
   return (bitmapClone[idx / CHAR_BIT] >> (idx % CHAR_BIT)) & 1;
 }
 
-void addBitMap(void* destination) {
-  unsigned char bitmap[32] = { 0 };
-  int i = 0;
-  for (i = 0; i < 2; i++) {
-   set_nth_bit(bitmap, i);
+// A block starts at a multiple of its size, so its bits are either
+// whole bytes or part of a single byte
+void set_bits(unsigned char *bitmap, int idx, int count, int value) {
+  unsigned char mask;
+  if (count >= CHAR_BIT) {
+    memset(bitmap + idx / CHAR_BIT, value ? 0xFF : 0, count / CHAR_BIT);
+    return;
+  }
+  mask = ((1 << count) - 1) << (idx % CHAR_BIT);
+  if (value) {
+    bitmap[idx / CHAR_BIT] |= mask;
+  } else {
+    bitmap[idx / CHAR_BIT] &= ~mask;
   }
-  memcpy(destination, &bitmap, 32);
 }
 
-void addToFreeList(free_block* currNode, size_t size) {
-  free_block* freeList = (free_block*)((void *)(pageHeader) + sizeof(kma_page_t));
-  
-  int sizeOfBlock = roundToPowerOfTwo(size);
+int any_bit_set(unsigned char *bitmap, int idx, int count) {
   int i;
-   for (i=7; i >= 0; i--) {
+  if (count < CHAR_BIT) {
+    return (bitmap[idx / CHAR_BIT] >> (idx % CHAR_BIT)) & ((1 << count) - 1);
+  }
+  for (i = idx / CHAR_BIT; i < (idx + count) / CHAR_BIT; i++) {
+    if (bitmap[i] != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
 
-	if (freeList[i].size == sizeOfBlock) {
-		currNode->nextFree = freeList[i].nextFree;
-		freeList[i].nextFree = currNode;
+void addToFreeList(void* ptr, size_t size) {
+  int sizeOfBlock = roundToPowerOfTwo(size);
+  int block = blockNumber(ptr);
+  free_link* currNode = getLink(block);
+  int i;
+   for (i=NUMORDERS-1; i >= 0; i--) {
+
+	if (ORDERSIZE(i) == sizeOfBlock) {
+		currNode->size = sizeOfBlock;
+		currNode->nextFree = freeList[i];
+		currNode->prevFree = -1;
+		if (currNode->nextFree >= 0) {
+			getLink(currNode->nextFree)->prevFree = block;
+		}
+		freeList[i] = block;
 		return;
 	}
   }
 }
 
-kma_page_t* initializePage(kma_size_t size) {
+void removeFromFreeList(void* ptr) {
+  free_link* currNode = getLink(blockNumber(ptr));
+  int i;
+
+  if (currNode->prevFree >= 0) {
+    getLink(currNode->prevFree)->nextFree = currNode->nextFree;
+  } else {
+    // the first block of its list
+    for (i = 0; ORDERSIZE(i) != currNode->size; i++)
+      ;
+    freeList[i] = currNode->nextFree;
+  }
+  if (currNode->nextFree >= 0) {
+    getLink(currNode->nextFree)->prevFree = currNode->prevFree;
+  }
+}
+
+kma_page_t* initializePage() {
   // Create a new page
   kma_page_t* page = get_page();
 
-  *((kma_page_t**)page->ptr) = page;
-
-  kma_page_t* frontOfPage = (kma_page_t*)page->ptr;
-  kma_page_t* startOfBitmap = (kma_page_t*)((void*)frontOfPage+roundToPowerOfTwo(sizeof(kma_page_t)));
-  addBitMap(startOfBitmap);  
+  // Back-pointer, bitmap and free links live in the side table, so the whole
+  // page starts out as a single free block
+  page_meta* meta = getPageMeta(page->ptr);
+  meta->page = page;
+  memset(meta->bitmap, 0, sizeof(meta->bitmap));
+  memset(meta->heads, 0, sizeof(meta->heads));
 
-  free_block* node = (free_block*)((void*)startOfBitmap + 32);
-  int i;
-  for (i=0; i < 7; i++) {
-      addToFreeList(node, 64*power(2,i));
-      node = (free_block*)((void*)node + (int)(64*power(2,i)));
-  }
-  return frontOfPage;
+  addToFreeList(page->ptr, PAGESIZE);
+  return page;
 }
 
-void setBitMap(free_block* currNode, kma_size_t size){
+void setBitMap(void* currNode, kma_size_t size){
   void* startOfPage = BASEADDR(currNode);
-  unsigned char* bitmap = (unsigned char*)(startOfPage+ roundToPowerOfTwo(sizeof(kma_page_t)));
+  page_meta* meta = getPageMeta(currNode);
+  unsigned char* bitmap = meta->bitmap;
 
-  int offset = (int)((void*)currNode - startOfPage);
+  int offset = (int)(currNode - startOfPage);
   int blockOffset = offset/32;
   int numBits = size/32;	// Should be fine since we're only passing powers of two-
 
-
-  int j;
-  for(j = 0; j < numBits; j++){
-    set_nth_bit(bitmap, blockOffset + j);
-  }
+  set_bits(bitmap, blockOffset, numBits, 1);
+  set_nth_bit(meta->heads, blockOffset);
 }
 
-void* splitNode(kma_size_t sizeOfBlock, free_block* blockPointer, free_block* freeList, int index){
+void* splitNode(kma_size_t sizeOfBlock, void* blockPointer, int index){
   void* halfwayPoint;
   if (index < 0){
     return blockPointer;
   }
-  else if (sizeOfBlock == freeList[index].size){
+  else if (sizeOfBlock == ORDERSIZE(index)){
 	  return blockPointer;
   }
   else{
     index = index -1;
-    halfwayPoint = (void*)((void*)blockPointer + freeList[index].size);
-    addToFreeList(halfwayPoint, freeList[index].size);
-    return splitNode(sizeOfBlock, blockPointer, freeList, index);
+    halfwayPoint = blockPointer + ORDERSIZE(index);
+    gStats.n_split++;
+    INSTR_EVENT(KMA_EV_SPLIT);
+    addToFreeList(halfwayPoint, ORDERSIZE(index));
+    return splitNode(sizeOfBlock, blockPointer, index);
   }
 }
 
-free_block* allocateSpace(kma_size_t size) {
+void* allocateSpace(kma_size_t size) {
 
 	// Find smallest possible block this size can fill
-	free_block* freeList = (free_block*)((void*)pageHeader + sizeof(kma_page_t));
 	kma_size_t sizeOfBlock = roundToPowerOfTwo(size);
   int i;
-	for (i=0; i<8; i++) {
+	for (i=0; i<NUMORDERS; i++) {
 
-		if (sizeOfBlock == freeList[i].size && freeList[i].nextFree != NULL) {
+		if (sizeOfBlock == ORDERSIZE(i) && freeList[i] >= 0) {
   		// Remove free node from list
-  		free_block* blockToAllocate = freeList[i].nextFree;
-  		freeList[i].nextFree = blockToAllocate->nextFree;
+  		void* blockToAllocate = blockAddress(freeList[i]);
+  		removeFromFreeList(blockToAllocate);
   		setBitMap(blockToAllocate, sizeOfBlock);
   		return blockToAllocate;
-    } else if (sizeOfBlock < freeList[i].size && freeList[i].nextFree != NULL) {
+    } else if (sizeOfBlock < ORDERSIZE(i) && freeList[i] >= 0) {
 			// Remove free node from list
-			free_block* blockToAllocate = freeList[i].nextFree;
-			freeList[i].nextFree = blockToAllocate->nextFree;
+			void* blockToAllocate = blockAddress(freeList[i]);
+			removeFromFreeList(blockToAllocate);
 			// Split empty node until 
-			void* allocationPoint = splitNode(sizeOfBlock, blockToAllocate, freeList, i--);
+			void* allocationPoint = splitNode(sizeOfBlock, blockToAllocate, i--);
              		setBitMap(allocationPoint, sizeOfBlock);
                    	return allocationPoint;
 		}
@@ -247,74 +292,63 @@ free_block* allocateSpace(kma_size_t size) {
 void* kma_malloc(kma_size_t size)
 {
   // Initialize free-list and bitmap
-  mallocCounter++;
-  totalRequested += size;
-  struct timeval start, end;
-  int mallocTime;
-  gettimeofday(&start, NULL);
-  totalNeeded = totalNeeded + size + roundToPowerOfTwo(size);
-	if(size > 4096){
+  INSTR_START(start);
+  stats_request(&gStats, size);
+  if (!freeListReady) {
+  initializeFreeList();
+  }
+	if(size > PAGESIZE){
+		// Large objects get a power-of-two run of whole pages
 		kma_page_t* page;
-  		page = get_page();
-		*((kma_page_t**)page->ptr) = page;
-    gettimeofday(&end, NULL);
-    mallocTime = end.tv_usec - start.tv_usec;
-    totalMallocTime += mallocTime;
-    if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
-		return page->ptr + sizeof(kma_page_t*);
+  		page = get_pages((size + PAGESIZE - 1) / PAGESIZE);
+		getPageMeta(page->ptr)->page = page;
+		gStats.bytes_used += page->size;
+    INSTR_END(KMA_EV_MALLOC, start);
+		return page->ptr;
 	}
 
-  if (!pageHeader) {
-  initializeFreeList();
-  }
+  gStats.bytes_used += roundToPowerOfTwo(size);
 	
   kma_page_t* allocatedPointer = (kma_page_t*)allocateSpace(size); 
   if (allocatedPointer != NULL) {
-    gettimeofday(&end, NULL);
-    mallocTime = end.tv_usec - start.tv_usec;
-    totalMallocTime += mallocTime;
-    if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
+    INSTR_END(KMA_EV_MALLOC, start);
 	 return allocatedPointer; //also bitmap size
   } else {
-	 initializePage(size);	 
+	 initializePage();
 	 // Actually fill the space
 	 allocatedPointer = (kma_page_t*) allocateSpace(size);
 
-   gettimeofday(&end, NULL);
-    mallocTime = end.tv_usec - start.tv_usec;
-    totalMallocTime += mallocTime;
-   if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
+   INSTR_END(KMA_EV_MALLOC, start);
 	 return allocatedPointer; //also bitmap size
 
   }
 }
 
-void clearBitMap(free_block* currNode, kma_size_t size){
+void clearBitMap(void* currNode, kma_size_t size){
   int sizeOfBlock = roundToPowerOfTwo(size);
   void* startOfPage = BASEADDR(currNode);
-  unsigned char* bitmap = (unsigned char*)(startOfPage+ 32);
+  page_meta* meta = getPageMeta(currNode);
+  unsigned char* bitmap = meta->bitmap;
 
 
-  int offset = (int)((void*)currNode - startOfPage);
+  int offset = (int)(currNode - startOfPage);
   int blockOffset = offset/32;
   int numBits = sizeOfBlock/32;
 
-  int j;
-  for(j = 0; j < numBits; j++){
-    clear_nth_bit(bitmap, blockOffset + j);
-  }
+  set_bits(bitmap, blockOffset, numBits, 0);
+  clear_nth_bit(meta->heads, blockOffset);
 }
 
 void coalesce(void* ptr, kma_size_t size){
 
   int sizeOfBlock = roundToPowerOfTwo(size);
 
-	if(sizeOfBlock == 4096){
+	if(sizeOfBlock == PAGESIZE){
 		return;
 	}
 
   void* startOfPage = BASEADDR(ptr);
-  unsigned char* bitmap = (unsigned char*)(startOfPage+32);
+  unsigned char* bitmap = getPageMeta(ptr)->bitmap;
 
   int offset = (int)((void*)ptr - startOfPage);
   int numBits = sizeOfBlock/32;
@@ -334,171 +368,127 @@ void coalesce(void* ptr, kma_size_t size){
     buddyPtr -= sizeOfBlock;
    }
 
-   int isBuddyFree = 1;
-   int i;
    int buddyDiff = (int)((void*)buddyPtr - startOfPage);
    int buddyOffset = buddyDiff/32;
-
-   for(i=0; i < numBits; i++){
-     if (get_nth_bit(bitmap, buddyOffset+i) == 1){
-       isBuddyFree = 0;
-     }
-   }
-
-   free_block* freeList = (free_block*)((void*)(pageHeader) + sizeof(kma_page_t));
-   free_block* listNode = NULL;
-   free_block* prevListNode = NULL;
-   if (isBuddyFree){
-
-	   int i = ((int)log2(sizeOfBlock)) - 5;
-
-     
-      prevListNode = &freeList[i];
-      listNode = freeList[i].nextFree;
-
-	    int buddyFreed = 0;
-	    int ptrFreed = 0;
-      while(listNode != NULL){
-        if((void*)listNode == buddyPtr){
-      		buddyFreed = 1;
-      		prevListNode->nextFree = listNode->nextFree;
-      		listNode = listNode->nextFree;
-      		if (ptrFreed){
-      			break;
-      		}
-        } else if ((void*)listNode == ptr){
-      		ptrFreed = 1;
-      		prevListNode->nextFree = listNode->nextFree;
-      		listNode = listNode->nextFree;
-      		if (buddyFreed){
-      			break;
-      		}
-	     } else{
-			     prevListNode = listNode;
-	    		 listNode = listNode->nextFree;
-		    }
-      }
-
-	if (buddyFreed && ptrFreed){
-		free_block* startOfFreeBlock;
-		if(buddyPtr < ptr){
-			startOfFreeBlock = buddyPtr;		
-		}
-		else{
-			startOfFreeBlock = ptr;
-		}
-	      addToFreeList(startOfFreeBlock, sizeOfBlock*2);
-        coalesce(startOfFreeBlock, sizeOfBlock*2);
-        return;  
+   int isBuddyFree = !any_bit_set(bitmap, buddyOffset, numBits);
+
+   // A free buddy region is covered by free blocks, and the one at
+   // its start is the whole buddy if it has the same size. ptr itself
+   // is always on the free list here.
+   if (isBuddyFree && getLink(blockNumber(buddyPtr))->size == sizeOfBlock){
+	void* startOfFreeBlock;
+	if(buddyPtr < ptr){
+		startOfFreeBlock = buddyPtr;		
 	}
-	else {
-		return;	
+	else{
+		startOfFreeBlock = ptr;
 	}
-
+	removeFromFreeList(buddyPtr);
+	removeFromFreeList(ptr);
+	gStats.n_coalesce++;
+	INSTR_EVENT(KMA_EV_COALESCE);
+	addToFreeList(startOfFreeBlock, sizeOfBlock*2);
+	coalesce(startOfFreeBlock, sizeOfBlock*2);
    }
 
 }
 
 void checkForFreePage(void* ptr){
   //PAGE FREEING
-  //if the whole bitmap (besides first 3) is 0, free the page.
-  //if there are no more free pages, free the pageHeader
+  //if the whole bitmap is 0, the page has coalesced into a single
+  //free block, take it off the free list and give the page back
+  page_meta* meta = getPageMeta(ptr);
   void* startOfPage = BASEADDR(ptr);
-  unsigned char* bitmap = (unsigned char*)(startOfPage+ roundToPowerOfTwo(sizeof(kma_page_t)));
-  
-  int isPageEmpty = 1;
-  //not sure about 256....might be 64?
+
   int i;
-  for (i = 2; i < 256; i++){
-    if(get_nth_bit(bitmap, i) == 1){
-      isPageEmpty = 0;
-      break;
+  for (i = 0; i < BITMAPSIZE / CHAR_BIT; i++){
+    if(meta->bitmap[i] != 0){
+      return;
     }
   }
 
-  free_block* freeList = (free_block*)((void*)(pageHeader) + sizeof(kma_page_t));
-  
-  void* endOfPage = BASEADDR(ptr) + PAGESIZE;
-  
-  //want to check if there are blocks in freeList not on this page
-  int isOnlyPage = 1;
-  if (isPageEmpty){
-    free_block* prevListNode;
-    free_block* listNode;
-    int i;
-    for (i = 0; i<8;i++){
-      prevListNode = &freeList[i];
-      listNode = freeList[i].nextFree;
-      while(listNode != NULL){
-        if(((void*)listNode > startOfPage) &&((void*)listNode < endOfPage)){
-          prevListNode->nextFree = listNode->nextFree;
-        }
-        else{
-          isOnlyPage = 0;
-        }
-	prevListNode = listNode;
-	listNode = listNode->nextFree;
-      }
-    }
-	kma_page_t* pagePtr = *((kma_page_t**)(startOfPage));
+  removeFromFreeList(startOfPage);
 
-    free_page(pagePtr);
-    if (isOnlyPage){
-	     kma_page_t* pageHeaderPtr = *((kma_page_t**)(pageHeader));
-       free_page(pageHeaderPtr);
-	     pageHeader = NULL;
-    }
-  }
+  free_page(meta->page);
+  meta->page = NULL;
 }
 
 void kma_free(void* ptr, kma_size_t size) {
-  freeCounter++;
-  struct timeval start, end;
-  int freeTime;
-  gettimeofday(&start, NULL);
-
-	if (size > 4096){
-		kma_page_t* page;  
-  	page = *((kma_page_t**)(ptr - sizeof(kma_page_t*))); 
-  	free_page(page);
-    gettimeofday(&end, NULL);
-    freeTime = end.tv_usec - start.tv_usec;
-    totalFreeTime += freeTime;
-    if (freeTime > worstFreeTime) worstFreeTime = freeTime;
-
-    averageMallocTime = totalMallocTime/mallocCounter;
-    averageFreeTime = totalFreeTime/freeCounter;
-    D(printf("Total requested: %d\n", (int)totalRequested));
-    D(printf("Total needed: %d\n", (int)totalNeeded));
-    D(printf("Number of mallocs: %d\n", mallocCounter));
-    D(printf("Number of frees: %d\n", freeCounter));
-    D(printf("Average allocation time: %d\n", averageMallocTime));
-    D(printf("Average free time: %d\n", averageFreeTime));
-    D(printf("Worst allocation time (microseconds)): %d\n", (int) worstMallocTime));
-    D(printf("Worst free time (microseconds)): %d\n\n", (int) worstFreeTime));
+  INSTR_START(start);
+  stats_release(&gStats, size);
+
+	if (size > PAGESIZE){
+		page_meta* meta = getPageMeta(ptr);
+		gStats.bytes_used -= meta->page->size;
+  	free_page(meta->page);
+  	meta->page = NULL;
+    INSTR_END(KMA_EV_FREE, start);
+
+    D(printf("Total requested: %d\n", (int)gStats.bytes_requested));
+    D(printf("Total used: %d\n", (int)gStats.bytes_used));
 		return;
 	}
 
+  gStats.bytes_used -= roundToPowerOfTwo(size);
   addToFreeList(ptr, size);
   clearBitMap(ptr, size);
   coalesce(ptr, size);
   checkForFreePage(ptr);
 
-  gettimeofday(&end, NULL);
-  freeTime = end.tv_usec - start.tv_usec;
-  totalFreeTime += freeTime;
-  if (freeTime > worstFreeTime) worstFreeTime = freeTime;
-
-  averageMallocTime = totalMallocTime/mallocCounter;
-  averageFreeTime = totalFreeTime/freeCounter;
-  D(printf("Total requested: %d\n", (int)totalRequested));
-        D(printf("Total needed: %d\n", (int)totalNeeded));
-        D(printf("Number of mallocs: %d\n", mallocCounter));
-        D(printf("Number of frees: %d\n", freeCounter));
-        D(printf("Average allocation time: %d\n", averageMallocTime));
-        D(printf("Average free time: %d\n", averageFreeTime));
-        D(printf("Worst allocation time (microseconds)): %d\n", (int) worstMallocTime));
-        D(printf("Worst free time (microseconds)): %d\n\n", (int) worstFreeTime));
+  INSTR_END(KMA_EV_FREE, start);
+
+  D(printf("Total requested: %d\n", (int)gStats.bytes_requested));
+  D(printf("Total used: %d\n", (int)gStats.bytes_used));
+}
+
+kma_stats_t* kma_stats() {
+  // free lists and bitmaps are kept out of the pages
+  return stats_snapshot(&gStats, sizeof(freeList)
+                        + MAXPAGES * sizeof(page_meta), 0);
+}
+
+void walkPage(void* ptr, int count, void* arg) {
+  kma_walk_t* walk = (kma_walk_t*) arg;
+  page_meta* meta = getPageMeta(ptr);
+  int offset = 0;
+  int size;
+
+  // pages of a front end are not ours
+  if (meta->page == NULL || meta->page->ptr != ptr) {
+    return;
+  }
+  if (meta->page->size > PAGESIZE) {
+    stats_region(walk->fn, walk->arg, ptr, meta->page->size, KMA_REGION_USED);
+    return;
+  }
+
+  while (offset < PAGESIZE) {
+    if (get_nth_bit(meta->bitmap, offset/32) == 0) {
+      // free blocks record their size
+      size = getLink(blockNumber(ptr + offset))->size;
+      stats_region(walk->fn, walk->arg, ptr + offset, size, KMA_REGION_FREE);
+    } else {
+      // an allocated block ends where the next block starts
+      size = 32;
+      while (offset + size < PAGESIZE
+             && get_nth_bit(meta->bitmap, (offset + size)/32) == 1
+             && get_nth_bit(meta->heads, (offset + size)/32) == 0) {
+        size += 32;
+      }
+      stats_region(walk->fn, walk->arg, ptr + offset, size, KMA_REGION_USED);
+    }
+    offset += size;
+  }
+}
+
+void kma_heap_walk(kma_walk_fn fn, void* arg) {
+  kma_walk_t walk = { fn, arg };
+
+  // without pages of our own there is no page table yet
+  if (!freeListReady) {
+    return;
+  }
+  page_walk(walkPage, &walk);
 }
 
 #endif // KMA_BUD
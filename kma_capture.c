@@ -0,0 +1,520 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: LD_PRELOAD shim that captures the allocations of a process
+ ***************************************************************************/
+
+/* "LD_PRELOAD=./kma_capture.so program" records every malloc, calloc,
+ * realloc, posix_memalign, memalign, aligned_alloc and free of the
+ * program to kma_capture.<pid>.cap, or to $KMA_CAPTURE (a %d in it is
+ * the pid). "kma_tracecvt -c" turns the capture into a trace. Only the
+ * process itself is captured, not the children it forks. */
+
+/************System include***********************************************/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma_capture.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Thread locals of a preloaded library are in the static TLS block,
+ * and initial-exec keeps their first access from calling malloc */
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* dlsym() allocates while the real functions are looked up. Those
+ * blocks come from here and are never freed */
+#define BOOTSIZE 65536
+
+#define DEFAULTPATH "kma_capture.%d.cap"
+
+enum CAPTURE_STATE
+  {
+    IDLE,		// before the first call
+    RESOLVING,		// looking up the real functions
+    CAPTURING,
+    STOPPED		// at exit, in a forked child, or without a file
+  };
+
+/* A thread's buffer of records. Buffers are mapped, never freed, and
+ * reused by later threads, so that the exit can flush them all */
+typedef struct capture_buf
+{
+  struct capture_buf* next;	// all buffers
+  int owned;		// by a running thread
+  int count;
+  uint32_t tid;
+  capture_rec_t recs[CAPTURE_BUFRECS];
+} capture_buf_t;
+
+/************Global Variables*********************************************/
+
+static void* (*gMalloc)(size_t);
+static void* (*gCalloc)(size_t, size_t);
+static void* (*gRealloc)(void*, size_t);
+static int (*gPosixMemalign)(void**, size_t, size_t);
+static void* (*gMemalign)(size_t, size_t);
+static void* (*gAlignedAlloc)(size_t, size_t);
+static void (*gFree)(void*);
+
+static volatile int gState = IDLE;
+static pthread_mutex_t gStartLock = PTHREAD_MUTEX_INITIALIZER;
+static int gFd = -1;
+static uint64_t gStart;
+
+static capture_buf_t* gBuffers = NULL;
+static uint32_t gNumThreads = 0;
+static pthread_key_t gKey;
+
+static char gBoot[BOOTSIZE] __attribute__((aligned(16)));
+static size_t gBootUsed = 0;
+
+// the thread's buffer, and whether it is inside the shim already
+static TLS capture_buf_t* tBuf = NULL;
+static TLS int tBusy = 0;
+
+/************Function Prototypes******************************************/
+static void start();
+static void stop() __attribute__((destructor));
+static void forked();
+static void endThread(void*);
+static void record(int, void*, size_t, uint64_t);
+static capture_buf_t* claimBuffer();
+static void flush(capture_buf_t*);
+static uint64_t now();
+static void* bootAlloc(size_t);
+static int inBoot(void*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void*
+malloc(size_t size)
+{
+  void* ptr;
+
+  if (gState <= RESOLVING)
+    {
+      start();
+      if (gState == RESOLVING)
+	{
+	  return bootAlloc(size);
+	}
+    }
+
+  ptr = gMalloc(size);
+  if (ptr != NULL)
+    {
+      record(CAPTURE_MALLOC, ptr, size, now());
+    }
+  return ptr;
+}
+
+void*
+calloc(size_t count, size_t size)
+{
+  void* ptr;
+
+  if (gState <= RESOLVING)
+    {
+      start();
+      if (gState == RESOLVING)
+	{
+	  // the arena is zero, and calloc() overflows are not dlsym's
+	  return bootAlloc(count * size);
+	}
+    }
+
+  ptr = gCalloc(count, size);
+  if (ptr != NULL)
+    {
+      record(CAPTURE_CALLOC, ptr, count * size, now());
+    }
+  return ptr;
+}
+
+void*
+realloc(void* old, size_t size)
+{
+  uint64_t freed;
+  void* ptr;
+
+  if (gState <= RESOLVING)
+    {
+      start();
+    }
+
+  // while resolving, all blocks are in the boot arena
+  if (gState == RESOLVING || inBoot(old))
+    {
+      ptr = malloc(size);
+      if (ptr != NULL && old != NULL)
+	{
+	  memcpy(ptr, old, (size < gBoot + BOOTSIZE - (char*) old)
+		 ? size : (size_t) (gBoot + BOOTSIZE - (char*) old));
+	}
+      return ptr;
+    }
+
+  // the old block is gone before the call returns
+  freed = now();
+  ptr = gRealloc(old, size);
+  if (old != NULL && (ptr != NULL || size == 0))
+    {
+      record(CAPTURE_FREE, old, 0, freed);
+    }
+  if (ptr != NULL)
+    {
+      record(CAPTURE_REALLOC, ptr, size, now());
+    }
+  return ptr;
+}
+
+int
+posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+  int res;
+
+  if (gState <= RESOLVING)
+    {
+      start();
+      if (gState == RESOLVING)
+	{
+	  return ENOMEM;
+	}
+    }
+
+  res = gPosixMemalign(ptr, alignment, size);
+  if (res == 0)
+    {
+      record(CAPTURE_MEMALIGN, *ptr, size, now());
+    }
+  return res;
+}
+
+void*
+memalign(size_t alignment, size_t size)
+{
+  void* ptr;
+
+  if (gState <= RESOLVING)
+    {
+      start();
+      if (gState == RESOLVING)
+	{
+	  return NULL;
+	}
+    }
+
+  ptr = gMemalign(alignment, size);
+  if (ptr != NULL)
+    {
+      record(CAPTURE_MEMALIGN, ptr, size, now());
+    }
+  return ptr;
+}
+
+void*
+aligned_alloc(size_t alignment, size_t size)
+{
+  void* ptr;
+
+  if (gState <= RESOLVING)
+    {
+      start();
+      if (gState == RESOLVING)
+	{
+	  return NULL;
+	}
+    }
+
+  ptr = gAlignedAlloc(alignment, size);
+  if (ptr != NULL)
+    {
+      record(CAPTURE_MEMALIGN, ptr, size, now());
+    }
+  return ptr;
+}
+
+void
+free(void* ptr)
+{
+  if (ptr == NULL || inBoot(ptr))
+    {
+      return;
+    }
+  if (gState == IDLE)
+    {
+      start();
+    }
+  if (gState == RESOLVING)
+    {
+      return;
+    }
+
+  // before the call, after it the block may be handed out again
+  record(CAPTURE_FREE, ptr, 0, now());
+  gFree(ptr);
+}
+
+/* Looks up the real functions and opens the capture. The thread that
+ * does so reenters through dlsym(), which then gets the boot arena */
+static void
+start()
+{
+  capture_header_t header;
+  struct timespec ts;
+  char path[4096];
+  char* env;
+
+  if (gState == RESOLVING)
+    {
+      return;
+    }
+
+  pthread_mutex_lock(&gStartLock);
+  if (gState != IDLE)
+    {
+      pthread_mutex_unlock(&gStartLock);
+      return;
+    }
+  gState = RESOLVING;
+  tBusy = 1;
+
+  gMalloc = dlsym(RTLD_NEXT, "malloc");
+  gCalloc = dlsym(RTLD_NEXT, "calloc");
+  gRealloc = dlsym(RTLD_NEXT, "realloc");
+  gPosixMemalign = dlsym(RTLD_NEXT, "posix_memalign");
+  gMemalign = dlsym(RTLD_NEXT, "memalign");
+  gAlignedAlloc = dlsym(RTLD_NEXT, "aligned_alloc");
+  gFree = dlsym(RTLD_NEXT, "free");
+  if (gMalloc == NULL || gCalloc == NULL || gRealloc == NULL
+      || gPosixMemalign == NULL || gMemalign == NULL
+      || gAlignedAlloc == NULL || gFree == NULL)
+    {
+      static const char message[] =
+	"ERROR: kma_capture: cannot find the real allocator.\n";
+      write(2, message, sizeof(message) - 1);
+      _exit(-1);
+    }
+
+  env = getenv("KMA_CAPTURE");
+  snprintf(path, sizeof(path), (env != NULL) ? env : DEFAULTPATH,
+	   (int) getpid());
+  gFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  gStart = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  header.version = CAPTURE_VERSION;
+  header.rec_size = sizeof(capture_rec_t);
+  header.start = gStart;
+  header.pid = getpid();
+  if (gFd >= 0 && write(gFd, &header, sizeof(header)) != sizeof(header))
+    {
+      close(gFd);
+      gFd = -1;
+    }
+
+  pthread_key_create(&gKey, endThread);
+  pthread_atfork(NULL, NULL, forked);
+
+  tBusy = 0;
+  gState = (gFd >= 0) ? CAPTURING : STOPPED;
+  pthread_mutex_unlock(&gStartLock);
+}
+
+/* At exit all buffers are flushed. Threads that still run past this
+ * point are no longer captured */
+static void
+stop()
+{
+  capture_buf_t* buf;
+
+  if (gState != CAPTURING)
+    {
+      return;
+    }
+  gState = STOPPED;
+
+  for (buf = gBuffers; buf != NULL; buf = buf->next)
+    {
+      flush(buf);
+    }
+  close(gFd);
+}
+
+// the child has a copy of the parent's records, which are not its own
+static void
+forked()
+{
+  capture_buf_t* buf;
+
+  if (gState != CAPTURING)
+    {
+      return;
+    }
+  gState = STOPPED;
+
+  for (buf = gBuffers; buf != NULL; buf = buf->next)
+    {
+      buf->count = 0;
+    }
+  close(gFd);
+}
+
+static void
+endThread(void* arg)
+{
+  capture_buf_t* buf = (capture_buf_t*) arg;
+
+  tBusy = 1;
+  flush(buf);
+  tBuf = NULL;
+  __atomic_store_n(&buf->owned, 0, __ATOMIC_RELEASE);
+  tBusy = 0;
+}
+
+static void
+record(int op, void* ptr, size_t size, uint64_t time)
+{
+  capture_buf_t* buf;
+  capture_rec_t* rec;
+
+  // allocations of the shim itself, e.g. by pthread_setspecific()
+  if (gState != CAPTURING || tBusy)
+    {
+      return;
+    }
+  tBusy = 1;
+
+  buf = tBuf;
+  if (buf == NULL)
+    {
+      buf = tBuf = claimBuffer();
+    }
+  if (buf != NULL)
+    {
+      rec = &buf->recs[buf->count];
+      rec->time = time;
+      rec->ptr = (uintptr_t) ptr;
+      rec->size = size;
+      rec->tid = buf->tid;
+      rec->op = op;
+      if (++buf->count == CAPTURE_BUFRECS)
+	{
+	  flush(buf);
+	}
+    }
+
+  tBusy = 0;
+}
+
+// a buffer of an exited thread, or a new one
+static capture_buf_t*
+claimBuffer()
+{
+  capture_buf_t* buf;
+
+  for (buf = gBuffers; buf != NULL; buf = buf->next)
+    {
+      if (__atomic_load_n(&buf->owned, __ATOMIC_RELAXED) == 0
+	  && __sync_bool_compare_and_swap(&buf->owned, 0, 1))
+	{
+	  break;
+	}
+    }
+
+  if (buf == NULL)
+    {
+      buf = mmap(NULL, sizeof(capture_buf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (buf == MAP_FAILED)
+	{
+	  return NULL;
+	}
+      buf->owned = 1;
+      do
+	{
+	  buf->next = gBuffers;
+	}
+      while (!__sync_bool_compare_and_swap(&gBuffers, buf->next, buf));
+    }
+
+  buf->tid = __atomic_fetch_add(&gNumThreads, 1, __ATOMIC_RELAXED);
+  pthread_setspecific(gKey, buf);
+  return buf;
+}
+
+/* One write per buffer, which O_APPEND keeps whole against the other
+ * threads */
+static void
+flush(capture_buf_t* buf)
+{
+  char* data = (char*) buf->recs;
+  size_t left = buf->count * sizeof(capture_rec_t);
+  ssize_t written;
+
+  while (left > 0)
+    {
+      written = write(gFd, data, left);
+      if (written < 0 && errno == EINTR)
+	{
+	  continue;
+	}
+      if (written <= 0)
+	{
+	  break;
+	}
+      data += written;
+      left -= written;
+    }
+  buf->count = 0;
+}
+
+static uint64_t
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec - gStart;
+}
+
+static void*
+bootAlloc(size_t size)
+{
+  size_t offset;
+
+  size = (size + 15) & ~(size_t) 15;
+  offset = __atomic_fetch_add(&gBootUsed, size, __ATOMIC_RELAXED);
+  if (offset + size > BOOTSIZE)
+    {
+      return NULL;
+    }
+  return gBoot + offset;
+}
+
+static int
+inBoot(void* ptr)
+{
+  return (char*) ptr >= gBoot && (char*) ptr < gBoot + BOOTSIZE;
+}
@@ -0,0 +1,74 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Capture files of the LD_PRELOAD shim kma_capture.so
+ ***************************************************************************/
+
+#ifndef __KMA_CAPTURE_H__
+#define __KMA_CAPTURE_H__
+
+/************System include***********************************************/
+#include <stdint.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* A capture is a capture_header_t followed by capture_rec_t records in
+ * host byte order. Every thread buffers its records and appends them
+ * a buffer at a time, so the records of different threads interleave
+ * in runs and are put in order by their time ("kma_tracecvt -c").
+ * A block is recorded after the call that returned it and before the
+ * call that frees it, so in time order no address is handed out twice
+ * while live. A realloc is a free of the old block and an allocation
+ * of the new one. */
+#define CAPTURE_MAGIC "KMACAPT1"
+#define CAPTURE_VERSION 1
+
+// records per thread buffer
+#define CAPTURE_BUFRECS 32768
+
+enum CAPTURE_OP
+  {
+    CAPTURE_MALLOC,
+    CAPTURE_CALLOC,
+    CAPTURE_REALLOC,
+    CAPTURE_MEMALIGN,	// posix_memalign, memalign and aligned_alloc
+    CAPTURE_FREE,
+    CAPTURE_NUMOPS
+  };
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t rec_size;	// sizeof(capture_rec_t)
+  uint64_t start;	// CLOCK_MONOTONIC at the start, in ns
+  uint32_t pid;
+  uint32_t pad;
+} capture_header_t;
+
+typedef struct
+{
+  uint64_t time;	// ns since the start
+  uint64_t ptr;
+  uint64_t size;	// 0 for CAPTURE_FREE
+  uint32_t tid;		// threads are numbered from 0 as they first allocate
+  uint8_t op;
+  uint8_t pad[3];
+} capture_rec_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_CAPTURE_H__ */
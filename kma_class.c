@@ -0,0 +1,59 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Size classes shared by the caching front ends
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+
+/************Private include**********************************************/
+#include "kma_class.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+size_class(kma_size_t size)
+{
+  int k;
+
+  assert(size <= MAXCLASSSIZE);
+
+  if (size <= MINCLASSSIZE)
+    {
+      return 0;
+    }
+
+  // 2^k < size <= 2^(k+1), split into four steps of 2^(k-2)
+  k = 31 - __builtin_clz(size - 1);
+  return 1 + (k - 5) * 4 + (((size - 1) >> (k - 2)) & 3);
+}
+
+kma_size_t
+class_size(int cls)
+{
+  int k;
+
+  assert(cls >= 0 && cls < NUMSIZECLASSES);
+
+  if (cls == 0)
+    {
+      return MINCLASSSIZE;
+    }
+
+  k = 5 + (cls - 1) / 4;
+  return (1 << k) + ((cls - 1) % 4 + 1) * (1 << (k - 2));
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Size classes shared by the caching front ends
+ ***************************************************************************/
+
+#ifndef __KMA_CLASS_H__
+#define __KMA_CLASS_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* 32 bytes, then four classes per doubling up to MAXCLASSSIZE */
+#define MINCLASSSIZE 32
+#define MAXCLASSSIZE 4096
+#define NUMSIZECLASSES 29
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Size class of a request
+ * ---------------------------------------------------------------------
+ *    Purpose: Get the smallest size class that holds a request
+ *    Input: the size, at most MAXCLASSSIZE
+ *    Output: the class, 0 <= class < NUMSIZECLASSES
+ ***********************************************************************/
+int size_class(kma_size_t size);
+
+/***********************************************************************
+ *  Title: Size of a size class
+ * ---------------------------------------------------------------------
+ *    Purpose: Get the block size of a size class
+ *    Input: the class
+ *    Output: the size in bytes
+ ***********************************************************************/
+kma_size_t class_size(int cls);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_CLASS_H__ */
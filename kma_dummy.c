@@ -50,6 +50,7 @@
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_stats.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -60,7 +61,10 @@
 
 /************Global Variables*********************************************/
 
+static kma_stats_t gStats;
+
 /************Function Prototypes******************************************/
+static void walkPage(void*, int, void*);
 
 /************External Declaration*****************************************/
 
@@ -89,6 +93,9 @@ void* kma_malloc(kma_size_t size)
   //}
   // oh yea, it worked
   
+  stats_request(&gStats, size);
+  gStats.bytes_used += page->size - sizeof(kma_page_t*);
+  
   return page->ptr + sizeof(kma_page_t*);
 }
 
@@ -98,7 +105,38 @@ void kma_free(void* ptr, kma_size_t size)
   
   page = *((kma_page_t**)(ptr - sizeof(kma_page_t*)));
   
+  stats_release(&gStats, size);
+  gStats.bytes_used -= page->size - sizeof(kma_page_t*);
+  
   free_page(page);
 }
 
+kma_stats_t* kma_stats()
+{
+  size_t meta;
+  
+  // the page pointer in front of every request
+  meta = (gStats.n_requests - gStats.n_frees) * sizeof(kma_page_t*);
+  
+  return stats_snapshot(&gStats, meta, meta);
+}
+
+void kma_heap_walk(kma_walk_fn fn, void* arg)
+{
+  kma_walk_t walk = { fn, arg };
+  
+  page_walk(walkPage, &walk);
+}
+
+static void walkPage(void* ptr, int count, void* arg)
+{
+  kma_walk_t* walk = (kma_walk_t*) arg;
+  
+  // the page pointer, then the rest of the page for the request
+  stats_region(walk->fn, walk->arg, ptr, sizeof(kma_page_t*),
+	       KMA_REGION_META);
+  stats_region(walk->fn, walk->arg, ptr + sizeof(kma_page_t*),
+	       PAGESIZE - sizeof(kma_page_t*), KMA_REGION_USED);
+}
+
 #endif // KMA_DUMMY
@@ -0,0 +1,241 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Fragmentation analysis for the test harness
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <string.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma_stats.h"
+#include "kma_frag.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define FRAGPARTS 6
+
+// the walk, page by page
+typedef struct
+{
+  kma_frag_t* frag;
+  size_t used;
+  size_t free;		// of the current page
+  int page;		// -1 before the first region
+  int inUse;		// the current page holds used or cached blocks
+} frag_walk_t;
+
+/************Global Variables*********************************************/
+
+// whether an inconsistent walk was reported
+static int gWarned = 0;
+
+static const char* kPartNames[FRAGPARTS] =
+  {
+    "live", "internal", "metadata", "external", "empty", "cached"
+  };
+
+/************Function Prototypes******************************************/
+static void walkRegion(kma_region_t*, void*);
+static void endPage(frag_walk_t*);
+static void countRun(void*, int, void*);
+static size_t part(kma_frag_t*, int);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void
+frag_measure(kma_frag_t* frag)
+{
+  frag_walk_t walk;
+  kma_stats_t* stats;
+  size_t free;
+  int runs = 0;
+
+  memset(frag, 0, sizeof(kma_frag_t));
+  memset(&walk, 0, sizeof(walk));
+  walk.frag = frag;
+  walk.page = -1;
+
+  kma_heap_walk(walkRegion, &walk);
+  endPage(&walk);
+
+  stats = kma_stats();
+  frag->pages = (size_t) stats->pages * PAGESIZE;
+  frag->live = stats->bytes_live;
+  // a walk that misses live blocks, or a corrupt heap, cannot say
+  // how much the used blocks are rounded up
+  if (walk.used >= frag->live)
+    {
+      frag->internal = walk.used - frag->live;
+    }
+  else
+    {
+      frag->inconsistent = 1;
+      if (!gWarned)
+	{
+	  fprintf(stderr, "WARNING: the heap walk found %zu used bytes, but"
+		  " %zu are live\n", walk.used, frag->live);
+	  gWarned = 1;
+	}
+    }
+
+  page_walk(countRun, &runs);
+  frag->offpage = stats->bytes_meta - frag->meta + runs * sizeof(kma_page_t);
+
+  free = frag->external + frag->empty;
+  frag->index = (free > 0) ? 1.0 - (double) frag->largest / free : 0.0;
+}
+
+void
+frag_write(FILE* file, long op, kma_frag_t* frag)
+{
+  fprintf(file, "%ld %zu %zu %zu %zu %zu %zu %zu %zu %zu %.4f\n", op,
+	  frag->pages, frag->live, frag->internal, frag->meta,
+	  frag->external, frag->empty, frag->cached, frag->offpage,
+	  frag->largest, frag->index);
+}
+
+void
+frag_add(kma_frag_sum_t* sum, kma_frag_t* frag)
+{
+  int i;
+
+  sum->inconsistent += frag->inconsistent;
+  if (frag->pages == 0)
+    {
+      return;
+    }
+
+  sum->samples++;
+  for (i = 0; i < FRAGPARTS; i++)
+    {
+      sum->share[i] += (double) part(frag, i) / frag->pages;
+      if (part(frag, i) > sum->peak[i])
+	{
+	  sum->peak[i] = part(frag, i);
+	}
+    }
+  sum->offpage += frag->offpage;
+  sum->largest += frag->largest;
+  sum->index += frag->index;
+  if (frag->index > sum->maxIndex)
+    {
+      sum->maxIndex = frag->index;
+    }
+}
+
+void
+frag_report(FILE* file, kma_frag_sum_t* sum)
+{
+  int i;
+
+  if (sum->samples == 0)
+    {
+      fprintf(file, "Fragmentation: no samples with pages in use\n");
+      return;
+    }
+
+  fprintf(file, "Fragmentation over %ld samples (share of the pages in use,"
+	  " peak bytes):\n", sum->samples);
+  for (i = 0; i < FRAGPARTS; i++)
+    {
+      fprintf(file, "  %-10s %6.2f%% %12zu\n", kPartNames[i],
+	      100.0 * sum->share[i] / sum->samples, sum->peak[i]);
+    }
+  fprintf(file, "  off-page metadata %.0f bytes, largest free block %.0f "
+	  "bytes, fragmentation index %.3f (max %.3f)\n",
+	  sum->offpage / sum->samples, sum->largest / sum->samples,
+	  sum->index / sum->samples, sum->maxIndex);
+  if (sum->inconsistent > 0)
+    {
+      fprintf(file, "  INCONSISTENT: in %ld samples the heap walk found "
+	      "fewer used bytes than are live, internal taken as 0\n",
+	      sum->inconsistent);
+    }
+}
+
+static void
+walkRegion(kma_region_t* region, void* arg)
+{
+  frag_walk_t* walk = (frag_walk_t*) arg;
+  kma_frag_t* frag = walk->frag;
+
+  if (region->page != walk->page)
+    {
+      endPage(walk);
+      walk->page = region->page;
+    }
+
+  switch (region->state)
+    {
+    case KMA_REGION_USED:
+      walk->used += region->size;
+      walk->inUse = 1;
+      break;
+    case KMA_REGION_CACHED:
+      frag->cached += region->size;
+      walk->inUse = 1;
+      break;
+    case KMA_REGION_META:
+      frag->meta += region->size;
+      break;
+    case KMA_REGION_FREE:
+      walk->free += region->size;
+      if (region->size > frag->largest)
+	{
+	  frag->largest = region->size;
+	}
+      break;
+    }
+}
+
+/* the free blocks of a page are external fragmentation, unless the
+ * page is held without anything in it */
+static void
+endPage(frag_walk_t* walk)
+{
+  if (walk->inUse)
+    {
+      walk->frag->external += walk->free;
+    }
+  else
+    {
+      walk->frag->empty += walk->free;
+    }
+  walk->free = 0;
+  walk->inUse = 0;
+}
+
+static void
+countRun(void* ptr, int count, void* arg)
+{
+  (*(int*) arg)++;
+}
+
+static size_t
+part(kma_frag_t* frag, int i)
+{
+  switch (i)
+    {
+    case 0:
+      return frag->live;
+    case 1:
+      return frag->internal;
+    case 2:
+      return frag->meta;
+    case 3:
+      return frag->external;
+    case 4:
+      return frag->empty;
+    default:
+      return frag->cached;
+    }
+}
@@ -0,0 +1,110 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Fragmentation analysis for the test harness
+ ***************************************************************************/
+
+#ifndef __KMA_FRAG_H__
+#define __KMA_FRAG_H__
+
+/************System include***********************************************/
+#include <stddef.h>
+#include <stdio.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Where the bytes of the pages in use go, from kma_stats() and a heap
+ * walk. The parts add up to the pages:
+ *
+ *   pages = live + internal + meta + external + empty + cached
+ *
+ * internal is what the used blocks are rounded up by, meta what the
+ * allocator keeps in its pages, external the free blocks in pages
+ * that also hold requests, empty the free blocks of pages that hold
+ * none, and cached the blocks a front end keeps for reuse. Metadata
+ * outside the pages (tables, and the kma_page_t of every page run)
+ * costs no pages and is counted apart. */
+typedef struct
+{
+  size_t pages;
+  size_t live;
+  size_t internal;
+  size_t meta;
+  size_t external;
+  size_t empty;
+  size_t cached;
+  size_t offpage;
+  size_t largest;	// free block
+  double index;		// 1 - largest / all free bytes, 0 if none free
+  int inconsistent;	// the walk found fewer used bytes than are live
+} kma_frag_t;
+
+// means over the samples with pages in use, and the peaks
+typedef struct
+{
+  long samples;
+  double share[6];	// of the pages: live ... cached
+  double offpage;
+  double largest;
+  double index;
+  double maxIndex;
+  size_t peak[6];
+  long inconsistent;	// samples, also of those without pages
+} kma_frag_sum_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Measures fragmentation
+ * ---------------------------------------------------------------------
+ *    Purpose: Splits the pages in use into the parts of kma_frag_t.
+ *             Walks the whole heap, so only exact while no other
+ *             thread allocates
+ *    Input: where to put the result
+ *    Output: none
+ ***********************************************************************/
+void frag_measure(kma_frag_t* frag);
+
+/***********************************************************************
+ *  Title: Writes a sample
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes one line "op pages live internal meta external
+ *             empty cached offpage largest index", see kma_frag.plt
+ *    Input: the file, the op and the sample
+ *    Output: none
+ ***********************************************************************/
+void frag_write(FILE* file, long op, kma_frag_t* frag);
+
+/***********************************************************************
+ *  Title: Adds up a sample
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds a sample to the means and peaks, if it has pages
+ *    Input: the sums, zeroed before the first sample, and the sample
+ *    Output: none
+ ***********************************************************************/
+void frag_add(kma_frag_sum_t* sum, kma_frag_t* frag);
+
+/***********************************************************************
+ *  Title: Reports fragmentation
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints the mean share of the pages and the peak of every
+ *             part, and the means of the rest
+ *    Input: the file and the sums
+ *    Output: none
+ ***********************************************************************/
+void frag_report(FILE* file, kma_frag_sum_t* sum);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_FRAG_H__ */
@@ -0,0 +1,15 @@
+# "gnuplot kma_frag.plt" plots the kma_frag.dat of kma_xxx -f N: where
+# the bytes of the pages in use go, stacked, and the fragmentation index
+set term png
+set output "kma_frag.png"
+set key left top
+plot "kma_frag.dat" using 1:($3+$4+$5+$6+$7+$8) with filledcurves x1 title "Cached", \
+     "kma_frag.dat" using 1:($3+$4+$5+$6+$7) with filledcurves x1 title "Empty pages", \
+     "kma_frag.dat" using 1:($3+$4+$5+$6) with filledcurves x1 title "External", \
+     "kma_frag.dat" using 1:($3+$4+$5) with filledcurves x1 title "Metadata", \
+     "kma_frag.dat" using 1:($3+$4) with filledcurves x1 title "Internal", \
+     "kma_frag.dat" using 1:3 with filledcurves x1 title "Live"
+
+set output "kma_frag_index.png"
+set yrange [0:1]
+plot "kma_frag.dat" using 1:11 with lines title "Fragmentation index"
@@ -0,0 +1,193 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Latency histograms for the test harness and benchmarks
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+/************Private include**********************************************/
+#include "kma_hist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+// time over which the TSC rate is measured
+#define CALIBRATION_NS 20000000
+
+/************Global Variables*********************************************/
+
+static double gNsPerTick = 0.0;
+
+/************Function Prototypes******************************************/
+static int bucketOf(uint64_t);
+static uint64_t bucketTop(int);
+static void calibrate();
+static uint64_t clockNs();
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void
+hist_record(kma_hist_t* hist, uint64_t ticks)
+{
+  if (hist->buckets == NULL)
+    {
+      hist->buckets = calloc(HIST_BUCKETS, sizeof(uint64_t));
+      assert(hist->buckets != NULL);
+    }
+
+  hist->buckets[bucketOf(ticks)]++;
+  hist->count++;
+  hist->total += ticks;
+  if (ticks > hist->max)
+    {
+      hist->max = ticks;
+    }
+}
+
+void
+hist_merge(kma_hist_t* into, kma_hist_t* from)
+{
+  int i;
+
+  if (from->count == 0)
+    {
+      return;
+    }
+  if (into->buckets == NULL)
+    {
+      into->buckets = calloc(HIST_BUCKETS, sizeof(uint64_t));
+      assert(into->buckets != NULL);
+    }
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+    {
+      into->buckets[i] += from->buckets[i];
+    }
+  into->count += from->count;
+  into->total += from->total;
+  if (from->max > into->max)
+    {
+      into->max = from->max;
+    }
+}
+
+uint64_t
+hist_percentile(kma_hist_t* hist, double fraction)
+{
+  uint64_t rank, seen = 0;
+  uint64_t top;
+  int i;
+
+  if (hist->count == 0)
+    {
+      return 0;
+    }
+
+  // the smallest value with at least that many values at or below it
+  rank = (uint64_t) (fraction * hist->count + 0.5);
+  if (rank < 1)
+    {
+      rank = 1;
+    }
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+    {
+      seen += hist->buckets[i];
+      if (seen >= rank)
+	{
+	  break;
+	}
+    }
+
+  top = bucketTop(i);
+  return (top < hist->max) ? top : hist->max;
+}
+
+double
+hist_ns(uint64_t ticks)
+{
+  if (gNsPerTick == 0.0)
+    {
+      calibrate();
+    }
+  return ticks * gNsPerTick;
+}
+
+void
+hist_free(kma_hist_t* hist)
+{
+  free(hist->buckets);
+  hist->buckets = NULL;
+  hist->count = 0;
+  hist->total = 0;
+  hist->max = 0;
+}
+
+static int
+bucketOf(uint64_t value)
+{
+  int msb;
+
+  if (value < HIST_SUBBUCKETS)
+    {
+      return (int) value;
+    }
+
+  msb = 63 - __builtin_clzll(value);
+  return ((msb - HIST_SUBBITS + 1) << HIST_SUBBITS)
+    + (int) ((value >> (msb - HIST_SUBBITS)) & (HIST_SUBBUCKETS - 1));
+}
+
+static uint64_t
+bucketTop(int bucket)
+{
+  int shift;
+
+  if (bucket < HIST_SUBBUCKETS)
+    {
+      return bucket;
+    }
+
+  shift = (bucket >> HIST_SUBBITS) - 1;
+  return (((uint64_t) (HIST_SUBBUCKETS + (bucket & (HIST_SUBBUCKETS - 1)))
+	   + 1) << shift) - 1;
+}
+
+static void
+calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  struct timespec pause = { 0, CALIBRATION_NS };
+  uint64_t ticks, ns;
+
+  ns = clockNs();
+  ticks = hist_ticks();
+  nanosleep(&pause, NULL);
+  ticks = hist_ticks() - ticks;
+  ns = clockNs() - ns;
+
+  gNsPerTick = (ticks > 0) ? (double) ns / ticks : 1.0;
+#else
+  // hist_ticks() already counts nanoseconds
+  gNsPerTick = 1.0;
+#endif
+}
+
+static uint64_t
+clockNs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,126 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Latency histograms for the test harness and benchmarks
+ ***************************************************************************/
+
+#ifndef __KMA_HIST_H__
+#define __KMA_HIST_H__
+
+/************System include***********************************************/
+#include <stdint.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Latencies are recorded in timer ticks: TSC cycles on x86, or
+ * nanoseconds of CLOCK_MONOTONIC_RAW elsewhere. hist_ns() converts
+ * them when reporting. Like an HDR histogram, buckets are logarithmic
+ * with HIST_SUBBUCKETS linear steps per power of two, so any value is
+ * known within 1/HIST_SUBBUCKETS (3%). The buckets are allocated on
+ * the first record, so unused histograms cost nothing. */
+#define HIST_SUBBITS 5
+#define HIST_SUBBUCKETS (1 << HIST_SUBBITS)
+#define HIST_BUCKETS ((64 - HIST_SUBBITS + 1) * HIST_SUBBUCKETS)
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t* buckets;
+} kma_hist_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Reads the timer
+ * ---------------------------------------------------------------------
+ *    Purpose: Get the current time in ticks, cheap enough to time
+ *             every single allocator call
+ *    Input: none
+ *    Output: the ticks
+ ***********************************************************************/
+static inline uint64_t hist_ticks();
+
+/***********************************************************************
+ *  Title: Records a latency
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds one value to a histogram
+ *    Input: the histogram and the value in ticks
+ *    Output: none
+ ***********************************************************************/
+void hist_record(kma_hist_t* hist, uint64_t ticks);
+
+/***********************************************************************
+ *  Title: Merges two histograms
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds all values of one histogram to another
+ *    Input: the histogram to add to and the one to add
+ *    Output: none
+ ***********************************************************************/
+void hist_merge(kma_hist_t* into, kma_hist_t* from);
+
+/***********************************************************************
+ *  Title: Percentile of a histogram
+ * ---------------------------------------------------------------------
+ *    Purpose: Get the value that the given fraction of all recorded
+ *             values does not exceed, at bucket precision
+ *    Input: the histogram and the fraction, e.g. 0.99
+ *    Output: the value in ticks, 0 for an empty histogram
+ ***********************************************************************/
+uint64_t hist_percentile(kma_hist_t* hist, double fraction);
+
+/***********************************************************************
+ *  Title: Converts ticks to nanoseconds
+ * ---------------------------------------------------------------------
+ *    Purpose: Scales a tick count to nanoseconds. On x86 the TSC rate
+ *             is calibrated against the clock on first use
+ *    Input: the ticks
+ *    Output: the nanoseconds
+ ***********************************************************************/
+double hist_ns(uint64_t ticks);
+
+/***********************************************************************
+ *  Title: Frees a histogram
+ * ---------------------------------------------------------------------
+ *    Purpose: Releases the buckets and clears the histogram
+ *    Input: the histogram
+ *    Output: none
+ ***********************************************************************/
+void hist_free(kma_hist_t* hist);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+static inline uint64_t
+hist_ticks()
+{
+  return __rdtsc();
+}
+#else
+#include <time.h>
+
+static inline uint64_t
+hist_ticks()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#endif /* __KMA_HIST_H__ */
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Compile-time instrumentation hooks for the allocators
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <stdio.h>
+
+/************Private include**********************************************/
+#include "kma_instr.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+#ifdef KMA_PROFILE
+kma_event_t gKmaEvents[KMA_EVENTS];
+
+static char* kEventNames[KMA_EVENTS] =
+  {
+    "malloc",
+    "free",
+    "page get",
+    "page put",
+    "split",
+    "coalesce",
+    "refill",
+    "flush"
+  };
+#endif
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void
+instr_report(FILE* out)
+{
+#ifdef KMA_PROFILE
+  kma_event_t* event;
+  int i;
+
+  fprintf(out, "%-10s %12s %12s %12s\n",
+	  "Event", "count", "avg (ns)", "worst (ns)");
+  for (i = 0; i < KMA_EVENTS; i++)
+    {
+      event = &gKmaEvents[i];
+      if (event->count == 0)
+	{
+	  continue;
+	}
+      if (event->ticks == 0)
+	{
+	  // untimed event
+	  fprintf(out, "%-10s %12llu\n", kEventNames[i],
+		  (unsigned long long) event->count);
+	  continue;
+	}
+      fprintf(out, "%-10s %12llu %12.0f %12.0f\n", kEventNames[i],
+	      (unsigned long long) event->count,
+	      hist_ns(event->ticks) / event->count, hist_ns(event->worst));
+    }
+#endif
+}
@@ -0,0 +1,103 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Compile-time instrumentation hooks for the allocators
+ ***************************************************************************/
+
+#ifndef __KMA_INSTR_H__
+#define __KMA_INSTR_H__
+
+/************System include***********************************************/
+#include <stdio.h>
+#include <stdint.h>
+
+/************Private include**********************************************/
+#include "kma_hist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Allocators mark events with these macros:
+ *
+ *   INSTR_START(start);                  at the start of a timed span
+ *   INSTR_END(KMA_EV_MALLOC, start);     at each of its exits
+ *   INSTR_EVENT(KMA_EV_SPLIT);           for an untimed event
+ *
+ * Normally they compile to nothing. Built with -DKMA_PROFILE ("make
+ * PROFILE=1") they count every event and add up the TSC ticks of timed
+ * spans, and the harness prints the totals at the end. The counters
+ * are plain globals: the backends and the page layer are serialized by
+ * their callers, and the front ends only count under the backend
+ * lock. */
+enum KMA_EVENT
+  {
+    KMA_EV_MALLOC,
+    KMA_EV_FREE,
+    KMA_EV_PAGE_GET,
+    KMA_EV_PAGE_PUT,
+    KMA_EV_SPLIT,
+    KMA_EV_COALESCE,
+    KMA_EV_REFILL,	// a front end takes blocks from the backend
+    KMA_EV_FLUSH,	// and gives them back
+    KMA_EVENTS
+  };
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t ticks;	// of timed spans only
+  uint64_t worst;
+} kma_event_t;
+
+#ifdef KMA_PROFILE
+#define INSTR_START(start) uint64_t start = hist_ticks()
+#define INSTR_END(event, start) instr_end(event, start)
+#define INSTR_EVENT(event) (gKmaEvents[event].count++)
+#else
+#define INSTR_START(start)
+#define INSTR_END(event, start) ((void) 0)
+#define INSTR_EVENT(event) ((void) 0)
+#endif
+
+/************Global Variables*********************************************/
+
+#ifdef KMA_PROFILE
+extern kma_event_t gKmaEvents[KMA_EVENTS];
+#endif
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Prints the event counters
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints count, average and worst time of every event
+ *             that occurred. Does nothing without KMA_PROFILE
+ *    Input: the stream
+ *    Output: none
+ ***********************************************************************/
+void instr_report(FILE* out);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#ifdef KMA_PROFILE
+static inline void
+instr_end(enum KMA_EVENT event, uint64_t start)
+{
+  uint64_t ticks = hist_ticks() - start;
+
+  gKmaEvents[event].count++;
+  gKmaEvents[event].ticks += ticks;
+  if (ticks > gKmaEvents[event].worst)
+    {
+      gKmaEvents[event].worst = ticks;
+    }
+}
+#endif
+
+#endif /* __KMA_INSTR_H__ */
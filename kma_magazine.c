@@ -0,0 +1,742 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Thread-safe magazine and depot front end for any kernel
+ *             memory allocator backend
+ ***************************************************************************/
+#ifdef KMA_MAGAZINE
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_class.h"
+#include "kma_instr.h"
+#include "kma_magazine.h"
+#include "kma_stats.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+typedef struct magazine
+{
+  struct magazine* next;
+  int rounds;
+  void* objs[MAGAZINE_ROUNDS];
+} magazine_t;
+
+/* header at the start of every page that magazines are carved from */
+typedef struct magazine_page
+{
+  kma_page_t* page;
+  struct magazine_page* next;	// pages with free magazines
+  struct magazine_page* prev;
+  struct magazine_page* nextPage;	// all pages, for the heap walk
+  struct magazine_page* prevPage;
+  magazine_t* free;
+  int used;
+} magazine_page_t;
+
+#define MAGAZINESPERPAGE \
+  ((PAGESIZE - sizeof(magazine_page_t)) / sizeof(magazine_t))
+
+/* Per size class store of full and empty magazines. The min counts
+ * track how many magazines the depot did not need since the last
+ * trim, that is its working set. */
+typedef struct
+{
+  pthread_mutex_t lock;
+  magazine_t* full;
+  magazine_t* empty;
+  int numFull;
+  int numEmpty;
+  int minFull;
+  int minEmpty;
+  int exchanges;
+} depot_t;
+
+/* Per thread, per size class: the loaded magazine, and the previously
+ * loaded one, which is always either full or empty. */
+typedef struct
+{
+  magazine_t* loaded;
+  magazine_t* previous;
+} magazine_cache_t;
+
+typedef struct thread_cache
+{
+  magazine_cache_t classes[NUMSIZECLASSES];
+  int registered;
+  kma_stats_t stats;	// requests of the thread
+  struct thread_cache* next;	// registered caches, for kma_stats()
+  struct thread_cache* prev;
+} thread_cache_t;
+
+/************Global Variables*********************************************/
+
+// protects the backend, the page allocator and the magazine pages
+static pthread_mutex_t gBackendLock = PTHREAD_MUTEX_INITIALIZER;
+
+static depot_t gDepot[NUMSIZECLASSES];
+
+// magazine pages that still have free magazines, and all of them
+static magazine_page_t* gMagazinePages = NULL;
+static magazine_page_t* gAllMagazinePages = NULL;
+static int gNumMagazinePages = 0;
+
+// requests too large for the magazines, under the backend lock
+static kma_stats_t gLargeStats;
+
+// the caches of all registered threads, and the requests of those
+// that exited
+static pthread_mutex_t gCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static thread_cache_t* gCaches = NULL;
+static kma_stats_t gExitedStats;
+
+static pthread_once_t gInitOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+
+static __thread thread_cache_t gCache;
+
+/************Function Prototypes******************************************/
+static void init();
+static void registerThread();
+static void threadExit(void*);
+static int capacity(int);
+static magazine_t* allocMagazine();
+static void freeMagazine(magazine_t*);
+static void releaseMagazines(magazine_t*, int);
+static magazine_t* trimDepot(depot_t*, magazine_t**);
+static void* slowMalloc(magazine_cache_t*, int);
+static void slowFree(magazine_cache_t*, int, void*);
+static void** collectMagazine(magazine_t*, void**, int*, int*);
+static int comparePages(const void*, const void*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void*
+kma_malloc(kma_size_t size)
+{
+  magazine_cache_t* cache;
+  magazine_t* swap;
+  void* res;
+
+  if (size > MAXCLASSSIZE)
+    {
+      pthread_mutex_lock(&gBackendLock);
+      stats_request(&gLargeStats, size);
+      res = kma_backend_malloc(size);
+      pthread_mutex_unlock(&gBackendLock);
+      return res;
+    }
+
+  stats_request(&gCache.stats, size);
+  cache = &gCache.classes[size_class(size)];
+
+  if (cache->loaded != NULL && cache->loaded->rounds > 0)
+    {
+      return cache->loaded->objs[--cache->loaded->rounds];
+    }
+
+  if (cache->previous != NULL && cache->previous->rounds > 0)
+    {
+      // previous is full, swap it in
+      swap = cache->loaded;
+      cache->loaded = cache->previous;
+      cache->previous = swap;
+      return cache->loaded->objs[--cache->loaded->rounds];
+    }
+
+  return slowMalloc(cache, size_class(size));
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+  magazine_cache_t* cache;
+  magazine_t* swap;
+  int cls;
+
+  if (size > MAXCLASSSIZE)
+    {
+      pthread_mutex_lock(&gBackendLock);
+      stats_release(&gLargeStats, size);
+      kma_backend_free(ptr, size);
+      pthread_mutex_unlock(&gBackendLock);
+      return;
+    }
+
+  stats_release(&gCache.stats, size);
+  cls = size_class(size);
+  cache = &gCache.classes[cls];
+
+  if (cache->loaded != NULL && cache->loaded->rounds < capacity(cls))
+    {
+      cache->loaded->objs[cache->loaded->rounds++] = ptr;
+      return;
+    }
+
+  if (cache->previous != NULL && cache->previous->rounds == 0)
+    {
+      // previous is empty, swap it in
+      swap = cache->loaded;
+      cache->loaded = cache->previous;
+      cache->previous = swap;
+      cache->loaded->objs[cache->loaded->rounds++] = ptr;
+      return;
+    }
+
+  slowFree(cache, cls, ptr);
+}
+
+void
+kma_magazine_flush()
+{
+  magazine_cache_t* cache;
+  magazine_t* full;
+  magazine_t* empty;
+  depot_t* depot;
+  int cls;
+
+  pthread_once(&gInitOnce, init);
+
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      cache = &gCache.classes[cls];
+      releaseMagazines(cache->loaded, cls);
+      releaseMagazines(cache->previous, cls);
+      cache->loaded = NULL;
+      cache->previous = NULL;
+
+      depot = &gDepot[cls];
+      pthread_mutex_lock(&depot->lock);
+      full = depot->full;
+      empty = depot->empty;
+      depot->full = NULL;
+      depot->empty = NULL;
+      depot->numFull = depot->minFull = 0;
+      depot->numEmpty = depot->minEmpty = 0;
+      pthread_mutex_unlock(&depot->lock);
+
+      releaseMagazines(full, cls);
+      releaseMagazines(empty, cls);
+    }
+}
+
+kma_stats_t*
+kma_stats()
+{
+  kma_stats_t front;
+  kma_stats_t* backend;
+  thread_cache_t* tc;
+  magazine_cache_t* cache;
+  magazine_t* mag;
+  size_t cached = 0;
+  size_t pages;
+  int cls;
+
+  pthread_once(&gInitOnce, init);
+
+  pthread_mutex_lock(&gBackendLock);
+  backend = kma_backend_stats();
+  front = gLargeStats;
+  pages = (size_t) gNumMagazinePages * PAGESIZE;
+  pthread_mutex_unlock(&gBackendLock);
+
+  pthread_mutex_lock(&gCacheLock);
+  stats_merge(&front, &gExitedStats);
+  for (tc = gCaches; tc != NULL; tc = tc->next)
+    {
+      stats_merge(&front, &tc->stats);
+    }
+  pthread_mutex_unlock(&gCacheLock);
+
+  /* rounds loaded by this thread. Other running threads swap their
+   * magazines without a lock, so their rounds count as used */
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      cache = &gCache.classes[cls];
+      if (cache->loaded != NULL)
+	{
+	  cached += stats_cached(cls, cache->loaded->rounds);
+	}
+      if (cache->previous != NULL)
+	{
+	  cached += stats_cached(cls, cache->previous->rounds);
+	}
+    }
+
+  // and those in the depots
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      pthread_mutex_lock(&gDepot[cls].lock);
+      for (mag = gDepot[cls].full; mag != NULL; mag = mag->next)
+	{
+	  cached += stats_cached(cls, mag->rounds);
+	}
+      pthread_mutex_unlock(&gDepot[cls].lock);
+    }
+
+  // the magazine pages are all metadata
+  return stats_frontend(&front, backend, cached, sizeof(gDepot) + pages,
+			pages);
+}
+
+void
+kma_heap_walk(kma_walk_fn fn, void* arg)
+{
+  magazine_page_t* mpage;
+  magazine_t* mag;
+  void** cached = NULL;
+  void** pages;
+  int count = 0, size = 0;
+  int numPages, cls, i;
+
+  pthread_once(&gInitOnce, init);
+
+  // the rounds of this thread and of the depots, as in kma_stats()
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      cached = collectMagazine(gCache.classes[cls].loaded, cached, &count,
+			       &size);
+      cached = collectMagazine(gCache.classes[cls].previous, cached, &count,
+			       &size);
+
+      pthread_mutex_lock(&gDepot[cls].lock);
+      for (mag = gDepot[cls].full; mag != NULL; mag = mag->next)
+	{
+	  cached = collectMagazine(mag, cached, &count, &size);
+	}
+      pthread_mutex_unlock(&gDepot[cls].lock);
+    }
+
+  pthread_mutex_lock(&gBackendLock);
+  stats_frontend_walk(fn, arg, cached, count);
+
+  // the magazine pages, in address order
+  pages = malloc((gNumMagazinePages + 1) * sizeof(void*));
+  assert(pages != NULL);
+  numPages = 0;
+  for (mpage = gAllMagazinePages; mpage != NULL; mpage = mpage->nextPage)
+    {
+      pages[numPages++] = mpage;
+    }
+  assert(numPages == gNumMagazinePages);
+  qsort(pages, numPages, sizeof(void*), comparePages);
+  for (i = 0; i < numPages; i++)
+    {
+      stats_region(fn, arg, pages[i], PAGESIZE, KMA_REGION_META);
+    }
+  pthread_mutex_unlock(&gBackendLock);
+
+  free(cached);
+  free(pages);
+}
+
+static void
+init()
+{
+  int cls;
+
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      pthread_mutex_init(&gDepot[cls].lock, NULL);
+    }
+  pthread_key_create(&gKey, threadExit);
+}
+
+static void
+registerThread()
+{
+  pthread_once(&gInitOnce, init);
+
+  if (!gCache.registered)
+    {
+      // make sure the magazines are returned when the thread exits
+      pthread_setspecific(gKey, gCache.classes);
+      gCache.registered = 1;
+
+      pthread_mutex_lock(&gCacheLock);
+      gCache.prev = NULL;
+      gCache.next = gCaches;
+      if (gCaches != NULL)
+	{
+	  gCaches->prev = &gCache;
+	}
+      gCaches = &gCache;
+      pthread_mutex_unlock(&gCacheLock);
+    }
+}
+
+static void
+threadExit(void* cache)
+{
+  magazine_cache_t* classes = (magazine_cache_t*) cache;
+  int cls;
+
+  assert(classes == gCache.classes);
+
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      releaseMagazines(classes[cls].loaded, cls);
+      releaseMagazines(classes[cls].previous, cls);
+      classes[cls].loaded = NULL;
+      classes[cls].previous = NULL;
+    }
+
+  // keep the thread's counts
+  pthread_mutex_lock(&gCacheLock);
+  stats_merge(&gExitedStats, &gCache.stats);
+  if (gCache.prev != NULL)
+    {
+      gCache.prev->next = gCache.next;
+    }
+  else
+    {
+      gCaches = gCache.next;
+    }
+  if (gCache.next != NULL)
+    {
+      gCache.next->prev = gCache.prev;
+    }
+  pthread_mutex_unlock(&gCacheLock);
+}
+
+static int
+capacity(int cls)
+{
+  int rounds = MAGAZINE_BYTES / class_size(cls);
+
+  if (rounds > MAGAZINE_ROUNDS)
+    {
+      return MAGAZINE_ROUNDS;
+    }
+  return rounds > 0 ? rounds : 1;
+}
+
+static magazine_t*
+allocMagazine()
+{
+  magazine_page_t* mpage;
+  magazine_t* mag;
+  kma_page_t* page;
+  int i;
+
+  pthread_mutex_lock(&gBackendLock);
+
+  if (gMagazinePages == NULL)
+    {
+      page = get_page();
+      gNumMagazinePages++;
+      mpage = (magazine_page_t*) page->ptr;
+      mpage->page = page;
+      mpage->next = NULL;
+      mpage->prev = NULL;
+      mpage->free = NULL;
+      mpage->used = 0;
+
+      mpage->prevPage = NULL;
+      mpage->nextPage = gAllMagazinePages;
+      if (mpage->nextPage != NULL)
+	{
+	  mpage->nextPage->prevPage = mpage;
+	}
+      gAllMagazinePages = mpage;
+
+      mag = (magazine_t*)((void*) mpage + sizeof(magazine_page_t));
+      for (i = 0; i < MAGAZINESPERPAGE; i++, mag++)
+	{
+	  mag->next = mpage->free;
+	  mpage->free = mag;
+	}
+      gMagazinePages = mpage;
+    }
+
+  mpage = gMagazinePages;
+  mag = mpage->free;
+  mpage->free = mag->next;
+  mpage->used++;
+
+  if (mpage->free == NULL)
+    {
+      // page exhausted, drop it from the list
+      gMagazinePages = mpage->next;
+      if (mpage->next != NULL)
+	{
+	  mpage->next->prev = NULL;
+	}
+    }
+
+  pthread_mutex_unlock(&gBackendLock);
+
+  mag->next = NULL;
+  mag->rounds = 0;
+  return mag;
+}
+
+static void
+freeMagazine(magazine_t* mag)
+{
+  magazine_page_t* mpage = (magazine_page_t*) BASEADDR(mag);
+
+  pthread_mutex_lock(&gBackendLock);
+
+  if (mpage->free == NULL)
+    {
+      // page has a free magazine again
+      mpage->prev = NULL;
+      mpage->next = gMagazinePages;
+      if (mpage->next != NULL)
+	{
+	  mpage->next->prev = mpage;
+	}
+      gMagazinePages = mpage;
+    }
+
+  mag->next = mpage->free;
+  mpage->free = mag;
+  mpage->used--;
+
+  if (mpage->used == 0)
+    {
+      if (mpage->prev != NULL)
+	{
+	  mpage->prev->next = mpage->next;
+	}
+      else
+	{
+	  gMagazinePages = mpage->next;
+	}
+      if (mpage->next != NULL)
+	{
+	  mpage->next->prev = mpage->prev;
+	}
+
+      if (mpage->prevPage != NULL)
+	{
+	  mpage->prevPage->nextPage = mpage->nextPage;
+	}
+      else
+	{
+	  gAllMagazinePages = mpage->nextPage;
+	}
+      if (mpage->nextPage != NULL)
+	{
+	  mpage->nextPage->prevPage = mpage->prevPage;
+	}
+      free_page(mpage->page);
+      gNumMagazinePages--;
+    }
+
+  pthread_mutex_unlock(&gBackendLock);
+}
+
+/* returns the rounds of a list of magazines to the backend and frees
+ * the magazines */
+static void
+releaseMagazines(magazine_t* mag, int cls)
+{
+  magazine_t* next;
+  kma_size_t size = class_size(cls);
+
+  while (mag != NULL)
+    {
+      next = mag->next;
+      if (mag->rounds > 0)
+	{
+	  INSTR_START(start);
+	  pthread_mutex_lock(&gBackendLock);
+	  while (mag->rounds > 0)
+	    {
+	      kma_backend_free(mag->objs[--mag->rounds], size);
+	    }
+	  INSTR_END(KMA_EV_FLUSH, start);
+	  pthread_mutex_unlock(&gBackendLock);
+	}
+      freeMagazine(mag);
+      mag = next;
+    }
+}
+
+/* Called with the depot lock held after every exchange. Once per
+ * interval, detaches the magazines the depot did not need and returns
+ * them as two lists, to be released after the lock is dropped. */
+static magazine_t*
+trimDepot(depot_t* depot, magazine_t** empty)
+{
+  magazine_t* full = NULL;
+  magazine_t* mag;
+
+  *empty = NULL;
+
+  if (depot->numFull < depot->minFull)
+    {
+      depot->minFull = depot->numFull;
+    }
+  if (depot->numEmpty < depot->minEmpty)
+    {
+      depot->minEmpty = depot->numEmpty;
+    }
+
+  if (++depot->exchanges < DEPOT_INTERVAL)
+    {
+      return NULL;
+    }
+
+  for (; depot->minFull > 0; depot->minFull--, depot->numFull--)
+    {
+      mag = depot->full;
+      depot->full = mag->next;
+      mag->next = full;
+      full = mag;
+    }
+  for (; depot->minEmpty > 0; depot->minEmpty--, depot->numEmpty--)
+    {
+      mag = depot->empty;
+      depot->empty = mag->next;
+      mag->next = *empty;
+      *empty = mag;
+    }
+
+  depot->exchanges = 0;
+  depot->minFull = depot->numFull;
+  depot->minEmpty = depot->numEmpty;
+
+  return full;
+}
+
+/* both magazines are empty: trade the previous one for a full one
+ * from the depot, or fall back to the backend */
+static void*
+slowMalloc(magazine_cache_t* cache, int cls)
+{
+  depot_t* depot = &gDepot[cls];
+  magazine_t* full;
+  magazine_t* trimFull = NULL;
+  magazine_t* trimEmpty = NULL;
+  void* res;
+
+  registerThread();
+
+  pthread_mutex_lock(&depot->lock);
+  full = depot->full;
+  if (full != NULL)
+    {
+      depot->full = full->next;
+      depot->numFull--;
+      if (cache->previous != NULL)
+	{
+	  cache->previous->next = depot->empty;
+	  depot->empty = cache->previous;
+	  depot->numEmpty++;
+	}
+      trimFull = trimDepot(depot, &trimEmpty);
+    }
+  pthread_mutex_unlock(&depot->lock);
+
+  releaseMagazines(trimFull, cls);
+  releaseMagazines(trimEmpty, cls);
+
+  if (full == NULL)
+    {
+      INSTR_START(start);
+      pthread_mutex_lock(&gBackendLock);
+      res = stats_backend_block(cls);
+      INSTR_END(KMA_EV_REFILL, start);
+      pthread_mutex_unlock(&gBackendLock);
+      return res;
+    }
+
+  full->next = NULL;
+  cache->previous = cache->loaded;
+  cache->loaded = full;
+  return cache->loaded->objs[--cache->loaded->rounds];
+}
+
+/* both magazines are full: hand the previous one to the depot and load
+ * an empty one */
+static void
+slowFree(magazine_cache_t* cache, int cls, void* ptr)
+{
+  depot_t* depot = &gDepot[cls];
+  magazine_t* empty;
+  magazine_t* trimFull;
+  magazine_t* trimEmpty;
+
+  registerThread();
+
+  pthread_mutex_lock(&depot->lock);
+  if (cache->previous != NULL)
+    {
+      cache->previous->next = depot->full;
+      depot->full = cache->previous;
+      depot->numFull++;
+    }
+  empty = depot->empty;
+  if (empty != NULL)
+    {
+      depot->empty = empty->next;
+      depot->numEmpty--;
+    }
+  trimFull = trimDepot(depot, &trimEmpty);
+  pthread_mutex_unlock(&depot->lock);
+
+  releaseMagazines(trimFull, cls);
+  releaseMagazines(trimEmpty, cls);
+
+  if (empty == NULL)
+    {
+      empty = allocMagazine();
+    }
+
+  empty->next = NULL;
+  cache->previous = cache->loaded;
+  cache->loaded = empty;
+  cache->loaded->objs[cache->loaded->rounds++] = ptr;
+}
+
+/* appends the rounds of a magazine to a growing array of blocks, and
+ * returns the array */
+static void**
+collectMagazine(magazine_t* mag, void** cached, int* count, int* size)
+{
+  int i;
+
+  if (mag == NULL)
+    {
+      return cached;
+    }
+
+  if (*count + mag->rounds > *size)
+    {
+      *size = 2 * (*count + mag->rounds);
+      cached = realloc(cached, *size * sizeof(void*));
+      assert(cached != NULL);
+    }
+  for (i = 0; i < mag->rounds; i++)
+    {
+      cached[(*count)++] = mag->objs[i];
+    }
+  return cached;
+}
+
+static int
+comparePages(const void* a, const void* b)
+{
+  void* x = *(void**) a;
+  void* y = *(void**) b;
+
+  return (x > y) - (x < y);
+}
+
+#endif // KMA_MAGAZINE
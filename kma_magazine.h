@@ -0,0 +1,53 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Interface of the magazine and depot front end
+ ***************************************************************************/
+
+#ifndef __KMA_MAGAZINE_H__
+#define __KMA_MAGAZINE_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* A magazine holds up to MAGAZINE_ROUNDS objects of one size class,
+ * but no more than MAGAZINE_BYTES worth of them (and at least one).
+ * Magazines themselves are carved out of pages from get_page(). */
+#define MAGAZINE_ROUNDS 31
+#define MAGAZINE_BYTES 32768
+
+/* every DEPOT_INTERVAL exchanges with a depot, the full and empty
+ * magazines that the depot did not need during the interval (its
+ * working set minimum) are released */
+#define DEPOT_INTERVAL 256
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Flushes the magazine layer
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns the calling thread's magazines and the contents
+ *             of all depots to the backend, and releases the magazine
+ *             pages. Threads return their magazines when they exit,
+ *             the main thread should call this before it checks the
+ *             page statistics
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+void kma_magazine_flush();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_MAGAZINE_H__ */
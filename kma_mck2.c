@@ -42,6 +42,7 @@
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_stats.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -52,6 +53,8 @@
 
 /************Global Variables*********************************************/
 
+static kma_stats_t gStats;
+
 /************Function Prototypes******************************************/
 
 /************External Declaration*****************************************/
@@ -70,4 +73,16 @@ kma_free(void* ptr, kma_size_t size)
   ;
 }
 
+kma_stats_t*
+kma_stats()
+{
+  return stats_snapshot(&gStats, 0, 0);
+}
+
+void
+kma_heap_walk(kma_walk_fn fn, void* arg)
+{
+  ;
+}
+
 #endif // KMA_MCK2
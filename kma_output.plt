@@ -1,8 +1,13 @@
+# "gnuplot kma_output.plt" plots kma_output.dat, and
+# "gnuplot -e 'binary=1' kma_output.plt" the kma_output.bin of kma_xxx -B
+if (!exists("binary")) binary = 0
+set macros
+if (binary) data = '"kma_output.bin" binary format="%int64%int64%int64"'; else data = '"kma_output.dat"'
+
 set term png
 set output "kma_output.png"
-plot "kma_output.dat" using 1:2 with lines title "Requested", \
-     "kma_output.dat" using 1:3 with lines title "Allocated"
+plot @data using 1:2 with lines title "Requested", \
+     @data using 1:3 with lines title "Allocated"
 
 set output "kma_waste.png"
-plot "kma_output.dat" using 1:($3-$2) with lines title "Waste"
-     
+plot @data using 1:($3-$2) with lines title "Waste"
@@ -64,7 +64,17 @@
 
 #define PAGESIZE 8192
 
-#define MAXPAGES 4096
+/* log2(MAXPAGES); the pool is managed as a buddy system of page runs
+ * of order 0 (one page) up to MAXPAGEORDER (the whole pool). The
+ * simulation builds ("make sim") raise it. */
+#ifndef MAXPAGEORDER
+#define MAXPAGEORDER 12
+#endif
+
+#define MAXPAGES (1 << MAXPAGEORDER)
+
+// bytes of the whole pool
+#define POOLSIZE ((size_t) MAXPAGES * PAGESIZE)
 
 /***********************************************************************
  *  Title: Base Address Macro
@@ -89,8 +99,12 @@ typedef struct
   int num_freed;
   int num_in_use;
   int page_size;
+  int num_peak;		// most pages in use at any time
 } kma_page_stat_t;
 
+// called by page_walk() with the first page and length of a run
+typedef void (*kma_page_walk_fn)(void* ptr, int count, void* arg);
+
 
 /************Global Variables*********************************************/
 
@@ -105,15 +119,62 @@ typedef struct
  ***********************************************************************/
 EXTERN kma_page_t* get_page();
 
+/***********************************************************************
+ *  Title: Allocates a run of contiguous memory pages
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates at least count contiguous pages. The run is
+ *             rounded up to a power of two pages and aligned to its
+ *             own size within the pool
+ *    Input: the number of pages
+ *    Output: the allocated page run (size holds the run length in
+ *            bytes), release it with free_page()
+ ***********************************************************************/
+EXTERN kma_page_t* get_pages(int count);
+
 /***********************************************************************
  *  Title: Releases a memory page 
  * ---------------------------------------------------------------------
- *    Purpose: Releases a memory page
+ *    Purpose: Releases a memory page or page run
  *    Input: the pointer to the memory page structure
  *    Output: none
  ***********************************************************************/
 EXTERN void free_page(kma_page_t*);
 
+/***********************************************************************
+ *  Title: Page number of an address
+ * ---------------------------------------------------------------------
+ *    Purpose: Map an address inside the pool to the number of the
+ *             page that contains it, for allocators that keep their
+ *             per-page metadata out of band
+ *    Input: pointer into an allocated page
+ *    Output: the page number, 0 <= number < MAXPAGES
+ ***********************************************************************/
+EXTERN int page_index(void*);
+
+/***********************************************************************
+ *  Title: Walks the allocated pages
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls a function for every allocated page run, in
+ *             address order, for the heap walks of the allocators.
+ *             The function must not get or free pages
+ *    Input: the function and an argument to pass on to it
+ *    Output: none
+ ***********************************************************************/
+EXTERN void page_walk(kma_page_walk_fn fn, void* arg);
+
+/***********************************************************************
+ *  Title: Allocates a side table
+ * ---------------------------------------------------------------------
+ *    Purpose: For allocators that keep their per-page metadata out of
+ *             band. Allocates a zeroed table of MAXPAGES entries, to
+ *             be indexed by page_index(). The simulation builds only
+ *             reserve it, so that just the entries of pages in use
+ *             get memory. The table is never freed
+ *    Input: the size of an entry
+ *    Output: the table
+ ***********************************************************************/
+EXTERN void* page_table(size_t size);
+
 /***********************************************************************
  *  Title: Memory page statistics
  * ---------------------------------------------------------------------
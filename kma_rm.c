@@ -45,11 +45,12 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/time.h>
 
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_instr.h"
+#include "kma_stats.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -64,19 +65,19 @@ typedef struct resource_map
   struct resource_map* nextBase;
 } free_block;
 
+// the free blocks in address order, for walking the pages
+typedef struct
+{
+  kma_walk_t walk;
+  free_block** blocks;
+  int count;
+  int next;
+} rm_walk_t;
+
 /************Global Variables*********************************************/
 
 static kma_page_t* pageHeader = NULL;
-size_t totalRequested = 0;
-size_t totalNeeded = 0;
-int mallocCounter = 0;
-int freeCounter = 0;
-int averageMallocTime = 0;
-int averageFreeTime = 0;
-int totalMallocTime = 0;
-int totalFreeTime = 0;
-int worstMallocTime = 0;
-int worstFreeTime = 0;
+static kma_stats_t gStats;
 
 /************Function Prototypes******************************************/
 
@@ -105,6 +106,8 @@ void removeFreeFromList(free_block* prevNode, kma_size_t size) {
       int currNodeSize = currNode->size;
       free_block* currNodeNext = currNode->nextBase;
       currNode = (free_block*)((void *)(currNode)+size);
+      gStats.n_split++;
+      INSTR_EVENT(KMA_EV_SPLIT);
       
       prevNode->nextBase = currNode;
       currNode->nextBase = currNodeNext;
@@ -137,17 +140,13 @@ free_block* findFreeBlockInsertionPoint(void* ptr){
 void*
 kma_malloc(kma_size_t size)
 { 
-  mallocCounter++;
-  struct timeval start, end;
-  int mallocTime;
-  gettimeofday(&start, NULL);
-  totalRequested += size;
-  totalNeeded += size;
+  INSTR_START(start);
+  stats_request(&gStats, size);
+  gStats.bytes_used += size;
 
   if (pageHeader == NULL){
     /* If firstFree is undefined, point it to the top of the page */
     kma_page_t* page = get_page();
-    totalNeeded += sizeof(kma_page_t);
 
     *((kma_page_t**)page->ptr) = page;
 
@@ -162,9 +161,7 @@ kma_malloc(kma_size_t size)
     freeList->nextBase = firstFree;
     firstFree->nextBase = NULL;
     firstFree->size = (PAGESIZE - sizeof(kma_page_t) - sizeof(free_block) - size);
-    gettimeofday(&end, NULL);
-    mallocTime = end.tv_usec - start.tv_usec;
-    if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
+    INSTR_END(KMA_EV_MALLOC, start);
     return (kma_page_t*)(((void *) pageHeader) + sizeof(kma_page_t) + sizeof(free_block));
   } 
   else {
@@ -178,10 +175,7 @@ kma_malloc(kma_size_t size)
       if ((node->size >= size) && (node->size - size > sizeof(free_block))) {
         // CHANGE FREE LIST
         removeFreeFromList(prevNode, size);
-        gettimeofday(&end, NULL);
-        mallocTime = end.tv_usec - start.tv_usec;
-        totalMallocTime += mallocTime;
-        if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
+        INSTR_END(KMA_EV_MALLOC, start);
         return node;
       } else {
         prevNode = node;
@@ -196,14 +190,10 @@ kma_malloc(kma_size_t size)
       // Allocate this space
       // CHANGE FREE LIST
       removeFreeFromList(prevNode, size);
-      gettimeofday(&end, NULL);
-      mallocTime = end.tv_usec - start.tv_usec;
-      totalMallocTime += mallocTime;
-      if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
+      INSTR_END(KMA_EV_MALLOC, start);
       return node;
     } else {
       kma_page_t* newPage = get_page();
-      totalNeeded += sizeof(kma_page_t);
       *((kma_page_t**)newPage->ptr) = newPage;
 
       kma_page_t* newPageHeader = (kma_page_t*)newPage->ptr;
@@ -219,10 +209,7 @@ kma_malloc(kma_size_t size)
 
       newNode->size = PAGESIZE - sizeof(kma_page_t) - sizeof(free_block) - size;
 
-      gettimeofday(&end, NULL);
-      mallocTime = end.tv_usec - start.tv_usec;
-      totalMallocTime += mallocTime;
-      if (mallocTime > worstMallocTime) worstMallocTime = mallocTime;
+      INSTR_END(KMA_EV_MALLOC, start);
       return (free_block*)((void*)newFreeList + sizeof(free_block));
 
     }
@@ -235,14 +222,21 @@ free_block* coalesce(free_block* prevFreeBlock, free_block* newNode) {
   if ((void*)prevFreeBlock + prevFreeBlock->size == (void*)newNode && (void*)newNode + newNode->size == (void*)newNode->nextBase) {  // Both previous and next node are free
     prevFreeBlock->size = prevFreeBlock->size + newNode->size + newNode->nextBase->size;
     prevFreeBlock->nextBase = newNode->nextBase->nextBase;
+    gStats.n_coalesce += 2;	// with both neighbours
+    INSTR_EVENT(KMA_EV_COALESCE);
+    INSTR_EVENT(KMA_EV_COALESCE);
     return prevFreeBlock;
   } else if ((void*)prevFreeBlock + prevFreeBlock->size == (void*)newNode) { // Free block before it
     prevFreeBlock->size = prevFreeBlock->size + newNode->size;
     prevFreeBlock->nextBase = newNode->nextBase;
+    gStats.n_coalesce++;
+    INSTR_EVENT(KMA_EV_COALESCE);
     return prevFreeBlock;
   } else if ((void*)newNode + newNode->size == (void*)newNode->nextBase) { // Free block after it
     newNode->size = newNode->size + newNode->nextBase->size;
     newNode->nextBase = newNode->nextBase->nextBase;
+    gStats.n_coalesce++;
+    INSTR_EVENT(KMA_EV_COALESCE);
     return newNode;
   }
   return newNode; 
@@ -257,12 +251,11 @@ kma_page_t* findNextPage(free_block* currNode) {
 
 void kma_free(void* ptr, kma_size_t size) {
 
-  freeCounter++;
+  INSTR_START(start);
+  stats_release(&gStats, size);
+  gStats.bytes_used -= size;
   free_block* prevFreeBlock = NULL;
   free_block* startOfFreeMemory = (free_block*)((void*)pageHeader + sizeof(kma_page_t));
-  struct timeval start, end;
-  int freeTime;
-  gettimeofday(&start, NULL);
 
     free_block* newNode = NULL;
     free_block* firstFreeBlock = startOfFreeMemory->nextBase;
@@ -290,22 +283,10 @@ void kma_free(void* ptr, kma_size_t size) {
       if (firstFreeBlock->nextBase == NULL) {
         free_page(pageToFree);
         pageHeader = NULL;
-        gettimeofday(&end, NULL);
-        freeTime = end.tv_usec - start.tv_usec;
-        totalFreeTime += freeTime;
-        if (freeTime > worstFreeTime) worstFreeTime = freeTime;
-
-        averageMallocTime = totalMallocTime/mallocCounter;
-        averageFreeTime = totalFreeTime/freeCounter;
-        D(printf("Total requested: %d\n", (int)totalRequested));
-        D(printf("Total needed: %d\n", (int)totalNeeded));
-        D(printf("Number of mallocs: %d\n", mallocCounter));
-        D(printf("Number of frees: %d\n", freeCounter));
-	D(printf("Total free time: %d\n", totalFreeTime));
-        D(printf("Average allocation time: %d\n", averageMallocTime));
-        D(printf("Average free time: %d\n", averageFreeTime));
-        D(printf("Worst allocation time (microseconds)): %d\n", (int) worstMallocTime));
-        D(printf("Worst free time (microseconds)): %d\n\n", (int) worstFreeTime));
+        INSTR_END(KMA_EV_FREE, start);
+
+        D(printf("Total requested: %d\n", (int)gStats.bytes_requested));
+        D(printf("Total used: %d\n", (int)gStats.bytes_used));
         return;
       } else {
         kma_page_t* nextPage = findNextPage(coalescedBlock);
@@ -323,22 +304,76 @@ void kma_free(void* ptr, kma_size_t size) {
     
   }
 
-  gettimeofday(&end, NULL);
-  freeTime = end.tv_usec - start.tv_usec;
-  totalFreeTime += freeTime;
-  if (freeTime > worstFreeTime) worstFreeTime = freeTime;
-  
-  averageMallocTime = totalMallocTime/mallocCounter;
-  averageFreeTime = totalFreeTime/freeCounter;
-  D(printf("Total requested: %d\n", (int)totalRequested));
-  D(printf("Total needed: %d\n", (int)totalNeeded));
-  D(printf("Number of mallocs: %d\n", mallocCounter));
-  D(printf("Number of frees: %d\n", freeCounter));
-  D(printf("Total free time: %d\n", totalFreeTime));
-  D(printf("Average allocation time: %d\n", averageMallocTime));
-  D(printf("Average free time: %d\n", averageFreeTime));
-  D(printf("Worst allocation time (microseconds)): %d\n", (int) worstMallocTime));
-  D(printf("Worst free time (microseconds)): %d\n\n", (int) worstFreeTime));
+  INSTR_END(KMA_EV_FREE, start);
+
+  D(printf("Total requested: %d\n", (int)gStats.bytes_requested));
+  D(printf("Total used: %d\n", (int)gStats.bytes_used));
+}
+
+kma_stats_t* kma_stats() {
+  // every page starts with its kma_page_t and the free list head
+  size_t meta = page_stats()->num_in_use
+    * (sizeof(kma_page_t) + sizeof(free_block));
+
+  return stats_snapshot(&gStats, meta, meta);
+}
+
+int compareBlocks(const void* a, const void* b) {
+  free_block* x = *(free_block**)a;
+  free_block* y = *(free_block**)b;
+  return (x > y) - (x < y);
+}
+
+void walkPage(void* ptr, int count, void* arg) {
+  rm_walk_t* rm = (rm_walk_t*) arg;
+  void* cursor = ptr + sizeof(kma_page_t) + sizeof(free_block);
+
+  stats_region(rm->walk.fn, rm->walk.arg, ptr, cursor - ptr, KMA_REGION_META);
+
+  // requests have no headers, so the used blocks between two free
+  // ones are reported as one region
+  while (rm->next < rm->count && (void*)rm->blocks[rm->next] < ptr + PAGESIZE) {
+    free_block* block = rm->blocks[rm->next++];
+    if ((void*)block < cursor) {
+      continue;
+    }
+    if ((void*)block > cursor) {
+      stats_region(rm->walk.fn, rm->walk.arg, cursor, (void*)block - cursor, KMA_REGION_USED);
+    }
+    stats_region(rm->walk.fn, rm->walk.arg, block, block->size, KMA_REGION_FREE);
+    cursor = (void*)block + block->size;
+  }
+  if (cursor < ptr + PAGESIZE) {
+    stats_region(rm->walk.fn, rm->walk.arg, cursor, ptr + PAGESIZE - cursor, KMA_REGION_USED);
+  }
+}
+
+void kma_heap_walk(kma_walk_fn fn, void* arg) {
+  rm_walk_t rm = { { fn, arg }, NULL, 0, 0 };
+  free_block* node;
+
+  if (pageHeader == NULL) {
+    return;
+  }
+
+  // the single free list runs through all pages, sort it by address
+  // to go along with the pages
+  free_block* freeList = (free_block*)((void*)pageHeader + sizeof(kma_page_t));
+  for (node = freeList->nextBase; node != NULL; node = node->nextBase) {
+    rm.count++;
+  }
+  rm.blocks = malloc((rm.count + 1) * sizeof(free_block*));
+  assert(rm.blocks != NULL);
+  rm.count = 0;
+  for (node = freeList->nextBase; node != NULL; node = node->nextBase) {
+    if (node->size > 0) {
+      rm.blocks[rm.count++] = node;
+    }
+  }
+  qsort(rm.blocks, rm.count, sizeof(free_block*), compareBlocks);
+
+  page_walk(walkPage, &rm);
+  free(rm.blocks);
 }
 
 #endif // KMA_RM
@@ -0,0 +1,182 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Common statistics of the allocators
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma_stats.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+#ifdef KMA_FRONTEND
+// a front end's walk around the backend's
+typedef struct
+{
+  kma_walk_t walk;
+  void** cached;	// sorted
+  int count;
+} frontend_walk_t;
+
+/* bytes the backend uses for a block of each size class, which may be
+ * rounded up further, 0 until the class is first used */
+static size_t gBlockSize[NUMSIZECLASSES];
+#endif
+
+/************Function Prototypes******************************************/
+#ifdef KMA_FRONTEND
+static int comparePointers(const void*, const void*);
+static void markCached(kma_region_t*, void*);
+#endif
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+kma_stats_t*
+stats_snapshot(kma_stats_t* stats, size_t meta, size_t page_meta)
+{
+  static kma_stats_t snapshot;
+  size_t total;
+
+  snapshot = *stats;
+  snapshot.pages = page_stats()->num_in_use;
+  snapshot.bytes_meta = meta;
+
+  total = (size_t) snapshot.pages * PAGESIZE;
+  assert(total >= snapshot.bytes_used + page_meta);
+  snapshot.bytes_held = total - snapshot.bytes_used - page_meta;
+
+  return &snapshot;
+}
+
+void
+stats_merge(kma_stats_t* into, kma_stats_t* from)
+{
+  int cls;
+
+  into->n_requests += STATS_READ(from->n_requests);
+  into->n_frees += STATS_READ(from->n_frees);
+  for (cls = 0; cls < STATCLASSES; cls++)
+    {
+      into->n_class[cls] += STATS_READ(from->n_class[cls]);
+    }
+  into->bytes_requested += STATS_READ(from->bytes_requested);
+  into->bytes_live += STATS_READ(from->bytes_live);
+}
+
+kma_stats_t*
+stats_frontend(kma_stats_t* front, kma_stats_t* backend, size_t cached,
+	       size_t meta, size_t page_meta)
+{
+  static kma_stats_t snapshot;
+
+  snapshot = *front;
+  snapshot.n_split = backend->n_split;
+  snapshot.n_coalesce = backend->n_coalesce;
+  snapshot.pages = backend->pages;
+
+  snapshot.bytes_used = backend->bytes_used - cached;
+  snapshot.bytes_meta = backend->bytes_meta + meta;
+  snapshot.bytes_held = backend->bytes_held + cached - page_meta;
+
+  return &snapshot;
+}
+
+void
+stats_region(kma_walk_fn fn, void* arg, void* addr, size_t size,
+	     enum KMA_REGION state)
+{
+  kma_region_t region;
+
+  region.addr = addr;
+  region.size = size;
+  region.state = state;
+  if (state == KMA_REGION_META)
+    {
+      region.cls = -1;
+    }
+  else if (size > MAXCLASSSIZE)
+    {
+      region.cls = NUMSIZECLASSES;
+    }
+  else
+    {
+      region.cls = size_class(size);
+    }
+  region.page = page_index(addr);
+
+  fn(&region, arg);
+}
+
+#ifdef KMA_FRONTEND
+void*
+stats_backend_block(int cls)
+{
+  size_t used;
+  void* block;
+
+  if (gBlockSize[cls] != 0)
+    {
+      return kma_backend_malloc(class_size(cls));
+    }
+
+  used = kma_backend_stats()->bytes_used;
+  block = kma_backend_malloc(class_size(cls));
+  if (block != NULL)
+    {
+      gBlockSize[cls] = kma_backend_stats()->bytes_used - used;
+    }
+  return block;
+}
+
+size_t
+stats_cached(int cls, int count)
+{
+  return (size_t) count * gBlockSize[cls];
+}
+
+void
+stats_frontend_walk(kma_walk_fn fn, void* arg, void** cached, int count)
+{
+  frontend_walk_t walk = { { fn, arg }, cached, count };
+
+  qsort(cached, count, sizeof(void*), comparePointers);
+  kma_backend_heap_walk(markCached, &walk);
+}
+
+static int
+comparePointers(const void* a, const void* b)
+{
+  void* x = *(void**) a;
+  void* y = *(void**) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+markCached(kma_region_t* region, void* arg)
+{
+  frontend_walk_t* walk = (frontend_walk_t*) arg;
+
+  if (region->state == KMA_REGION_USED
+      && bsearch(&region->addr, walk->cached, walk->count, sizeof(void*),
+		 comparePointers) != NULL)
+    {
+      region->state = KMA_REGION_CACHED;
+    }
+  walk->walk.fn(region, walk->walk.arg);
+}
+#endif
@@ -0,0 +1,235 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Common statistics of the allocators
+ ***************************************************************************/
+
+#ifndef __KMA_STATS_H__
+#define __KMA_STATS_H__
+
+/************System include***********************************************/
+#include <stddef.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "kma_class.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Requests are counted by the size classes of kma_class.h, whatever
+ * the allocator's own classes are, and larger ones in the last slot. */
+#define STATCLASSES (NUMSIZECLASSES + 1)
+
+/* The request counters of a front end's thread cache are only written
+ * by its thread, but kma_stats() reads them from any thread. They are
+ * updated with relaxed atomic stores and read with relaxed loads, which
+ * are plain moves. */
+#define STATS_ADD(counter, n)						\
+  __atomic_store_n(&(counter),						\
+		   __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n),	\
+		   __ATOMIC_RELAXED)
+#define STATS_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* Every byte of the pages in use is either used by a live request
+ * (including what its block is rounded up by), metadata, or held free
+ * by the allocator:
+ *
+ *   pages * PAGESIZE = bytes_used + metadata in the pages + bytes_held
+ *
+ * so bytes_used - bytes_live is the internal and bytes_held the
+ * external fragmentation. bytes_meta also counts out-of-band tables. */
+typedef struct
+{
+  unsigned long n_requests;
+  unsigned long n_frees;
+  unsigned long n_class[STATCLASSES];	// requests per size class
+  unsigned long n_split;
+  unsigned long n_coalesce;
+  size_t bytes_requested;	// by all requests so far
+  size_t bytes_live;	// requested and not yet freed
+  size_t bytes_used;	// blocks of the live requests
+  size_t bytes_meta;
+  size_t bytes_held;
+  int pages;		// in use
+} kma_stats_t;
+
+/* A heap walk reports every region of the pages in use, as far as the
+ * allocator can tell them apart: blocks of live requests, free blocks,
+ * blocks a front end caches for reuse, and metadata in the pages. */
+enum KMA_REGION
+  {
+    KMA_REGION_USED,
+    KMA_REGION_FREE,
+    KMA_REGION_CACHED,
+    KMA_REGION_META
+  };
+
+typedef struct
+{
+  void* addr;
+  size_t size;
+  enum KMA_REGION state;
+  int cls;		// of the size, NUMSIZECLASSES if larger, -1 for META
+  int page;		// page_index() of addr
+} kma_region_t;
+
+typedef void (*kma_walk_fn)(kma_region_t* region, void* arg);
+
+// what the backends pass through page_walk() to their page walks
+typedef struct
+{
+  kma_walk_fn fn;
+  void* arg;
+} kma_walk_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Statistics of the allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Get a snapshot of the statistics. Every backend and
+ *             front end implements this. The front ends count blocks
+ *             in their caches as held, but only look into the caches
+ *             of the calling thread and of threads that exited, so
+ *             blocks cached by other running threads count as used
+ *    Input: none
+ *    Output: the statistics, valid until the next call
+ ***********************************************************************/
+kma_stats_t* kma_stats();
+
+#ifdef KMA_FRONTEND
+kma_stats_t* kma_backend_stats();
+#endif
+
+/***********************************************************************
+ *  Title: Walks the heap
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls a function for every region of the pages in use,
+ *             page by page. Every backend and front end implements
+ *             this; allocators that cannot tell two adjacent used
+ *             blocks apart report them as one region. The front ends
+ *             report blocks cached by other running threads as used,
+ *             and the function must not allocate or free
+ *    Input: the function and an argument to pass on to it
+ *    Output: none
+ ***********************************************************************/
+void kma_heap_walk(kma_walk_fn fn, void* arg);
+
+#ifdef KMA_FRONTEND
+void kma_backend_heap_walk(kma_walk_fn fn, void* arg);
+#endif
+
+/***********************************************************************
+ *  Title: Reports a region of a heap walk
+ * ---------------------------------------------------------------------
+ *    Purpose: For the heap walks. Fills in the size class and page of
+ *             a region and passes it on
+ *    Input: the walk function and its argument, the region's address,
+ *           size and state
+ *    Output: none
+ ***********************************************************************/
+void stats_region(kma_walk_fn fn, void* arg, void* addr, size_t size,
+		  enum KMA_REGION state);
+
+/***********************************************************************
+ *  Title: Finishes a snapshot
+ * ---------------------------------------------------------------------
+ *    Purpose: For the backends. Copies their statistics, fills in the
+ *             pages in use and derives the held bytes from them
+ *    Input: the statistics, the metadata bytes and how many of those
+ *           are inside the pages
+ *    Output: the snapshot, valid until the next call
+ ***********************************************************************/
+kma_stats_t* stats_snapshot(kma_stats_t* stats, size_t meta,
+			    size_t page_meta);
+
+/***********************************************************************
+ *  Title: Merges request counters
+ * ---------------------------------------------------------------------
+ *    Purpose: For the front ends, which count requests per thread.
+ *             Adds the request and free counts and bytes of one set
+ *             of statistics to another
+ *    Input: the statistics to add to and the ones to add
+ *    Output: none
+ ***********************************************************************/
+void stats_merge(kma_stats_t* into, kma_stats_t* from);
+
+/***********************************************************************
+ *  Title: Finishes a front end snapshot
+ * ---------------------------------------------------------------------
+ *    Purpose: Combines the request counters of a front end with the
+ *             backend's statistics. Blocks cached by the front end
+ *             are used as far as the backend knows, and become held
+ *    Input: the front end's request counters, the backend's
+ *           statistics, the bytes cached by the front end, its own
+ *           metadata and how many of those are in pages it took
+ *    Output: the snapshot, valid until the next call
+ ***********************************************************************/
+kma_stats_t* stats_frontend(kma_stats_t* front, kma_stats_t* backend,
+			    size_t cached, size_t meta, size_t page_meta);
+
+#ifdef KMA_FRONTEND
+/***********************************************************************
+ *  Title: Gets a block of a size class from the backend
+ * ---------------------------------------------------------------------
+ *    Purpose: For the front ends, with the backend lock held. Calls
+ *             kma_backend_malloc(), and on the first call for a class
+ *             also measures how many bytes the backend uses for it
+ *    Input: the size class
+ *    Output: the block, NULL on failure
+ ***********************************************************************/
+void* stats_backend_block(int cls);
+
+/***********************************************************************
+ *  Title: Backend bytes of cached blocks
+ * ---------------------------------------------------------------------
+ *    Purpose: Get how many bytes the backend uses for a number of
+ *             blocks of a size class
+ *    Input: the size class and the number of blocks
+ *    Output: the bytes
+ ***********************************************************************/
+size_t stats_cached(int cls, int count);
+
+/***********************************************************************
+ *  Title: Walks the backend's heap for a front end
+ * ---------------------------------------------------------------------
+ *    Purpose: With the backend lock held. Calls kma_backend_heap_walk()
+ *             and reports the used blocks that the front end caches
+ *             as cached
+ *    Input: the walk function and its argument, and the blocks in
+ *           the front end's caches, which get sorted
+ *    Output: none
+ ***********************************************************************/
+void stats_frontend_walk(kma_walk_fn fn, void* arg, void** cached,
+			 int count);
+#endif
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+static inline void
+stats_request(kma_stats_t* stats, kma_size_t size)
+{
+  STATS_ADD(stats->n_requests, 1);
+  STATS_ADD(stats->n_class[(size > MAXCLASSSIZE)
+			   ? NUMSIZECLASSES : size_class(size)], 1);
+  STATS_ADD(stats->bytes_requested, size);
+  STATS_ADD(stats->bytes_live, size);
+}
+
+static inline void
+stats_release(kma_stats_t* stats, kma_size_t size)
+{
+  STATS_ADD(stats->n_frees, 1);
+  STATS_ADD(stats->bytes_live, -(size_t) size);
+}
+
+#endif /* __KMA_STATS_H__ */
@@ -0,0 +1,558 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Thread-safe front end with per-thread caches for any
+ *             kernel memory allocator backend
+ ***************************************************************************/
+#ifdef KMA_TCACHE
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_class.h"
+#include "kma_instr.h"
+#include "kma_tcache.h"
+#include "kma_stats.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+// cached blocks are linked through their first word, blocks on a
+// remote free list also carry their size class in the second
+typedef struct cached_block
+{
+  struct cached_block* next;
+  int cls;
+} cached_block_t;
+
+typedef struct
+{
+  cached_block_t* head;
+  int count;
+} tcache_bin_t;
+
+enum HEAP_STATE
+  {
+    UNUSED,
+    ACTIVE,
+    ABANDONED
+  };
+
+// owner of a page whose cached blocks went to several heaps
+#define SHARED ((tcache_t*) 1)
+
+/* The cache of one thread. Heaps outlive their threads. An exiting
+ * thread gives up its pages, but a remote free that raced with the exit
+ * still lands on the abandoned heap, until a new thread adopts it or
+ * kma_tcache_flush() drains it. */
+typedef struct
+{
+  tcache_bin_t bins[NUMSIZECLASSES];
+  cached_block_t* remote;	// pushed by other threads, lock-free
+  enum HEAP_STATE state;
+  kma_stats_t stats;	// requests of the threads that used the heap
+} tcache_t;
+
+/* The heap that cached the blocks of a page, frees from other threads
+ * are handed back to it. A page is owned only while the caches hold
+ * blocks of it that they took from the backend, and only if they all
+ * went to the same heap. */
+typedef struct
+{
+  tcache_t* owner;
+  unsigned short blocks;	// taken from the backend and not flushed
+} page_owner_t;
+
+/************Global Variables*********************************************/
+
+static pthread_mutex_t gBackendLock = PTHREAD_MUTEX_INITIALIZER;
+
+// requests too large for the cache, under the backend lock
+static kma_stats_t gLargeStats;
+
+static pthread_mutex_t gHeapLock = PTHREAD_MUTEX_INITIALIZER;
+static tcache_t gHeaps[TCACHE_MAXHEAPS];
+
+// page_table(), MAXPAGES entries under the backend lock
+static page_owner_t* gPages = NULL;
+
+static pthread_once_t gKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+
+static __thread tcache_t* gHeap = NULL;
+
+/************Function Prototypes******************************************/
+static int walkable(tcache_t*);
+static void** addBlock(void**, int*, int*, void*);
+static int batchSize(int);
+static tcache_t* adoptHeap();
+static void pushBlock(tcache_t*, void*, int);
+static void remoteFree(tcache_t*, void*, int);
+static void collectRemote(tcache_t*);
+static void refill(tcache_t*, int);
+static void flush(tcache_bin_t*, int, int);
+static void flushHeap(tcache_t*);
+static void disownPages(tcache_t*);
+static void disownPage(void*, int, void*);
+static void createKey();
+static void threadExit(void*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void*
+kma_malloc(kma_size_t size)
+{
+  tcache_t* heap = gHeap;
+  tcache_bin_t* bin;
+  cached_block_t* block;
+  void* res;
+  int cls;
+
+  if (size > MAXCLASSSIZE)
+    {
+      pthread_mutex_lock(&gBackendLock);
+      stats_request(&gLargeStats, size);
+      res = kma_backend_malloc(size);
+      pthread_mutex_unlock(&gBackendLock);
+      return res;
+    }
+
+  if (heap == NULL)
+    {
+      heap = adoptHeap();
+    }
+
+  cls = size_class(size);
+  bin = &heap->bins[cls];
+
+  if (bin->head == NULL)
+    {
+      // slow path: take back what other threads freed, then refill
+      collectRemote(heap);
+      if (bin->head == NULL)
+	{
+	  refill(heap, cls);
+	  if (bin->head == NULL)
+	    {
+	      return NULL;
+	    }
+	}
+    }
+
+  block = bin->head;
+  bin->head = block->next;
+  bin->count--;
+
+  stats_request(&heap->stats, size);
+  return block;
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+  tcache_t* heap = gHeap;
+  tcache_t* owner;
+  int cls;
+
+  if (size > MAXCLASSSIZE)
+    {
+      pthread_mutex_lock(&gBackendLock);
+      stats_release(&gLargeStats, size);
+      kma_backend_free(ptr, size);
+      pthread_mutex_unlock(&gBackendLock);
+      return;
+    }
+
+  if (heap == NULL)
+    {
+      heap = adoptHeap();
+    }
+
+  cls = size_class(size);
+  stats_release(&heap->stats, size);
+
+  owner = __atomic_load_n(&gPages[page_index(ptr)].owner, __ATOMIC_RELAXED);
+  if (owner != NULL && owner != SHARED && owner != heap)
+    {
+      remoteFree(owner, ptr, cls);
+      return;
+    }
+
+  pushBlock(heap, ptr, cls);
+}
+
+void
+kma_tcache_flush()
+{
+  int i;
+
+  if (gHeap != NULL)
+    {
+      flushHeap(gHeap);
+    }
+
+  // nobody collects for abandoned heaps, drain their remote frees
+  pthread_mutex_lock(&gHeapLock);
+  for (i = 0; i < TCACHE_MAXHEAPS; i++)
+    {
+      if (gHeaps[i].state == ABANDONED)
+	{
+	  flushHeap(&gHeaps[i]);
+	}
+    }
+  pthread_mutex_unlock(&gHeapLock);
+}
+
+kma_stats_t*
+kma_stats()
+{
+  kma_stats_t front;
+  kma_stats_t* backend;
+  size_t cached = 0;
+  int i, cls;
+
+  pthread_mutex_lock(&gBackendLock);
+  backend = kma_backend_stats();
+  front = gLargeStats;
+  pthread_mutex_unlock(&gBackendLock);
+
+  pthread_mutex_lock(&gHeapLock);
+  for (i = 0; i < TCACHE_MAXHEAPS; i++)
+    {
+      if (gHeaps[i].state == UNUSED)
+	{
+	  continue;
+	}
+      stats_merge(&front, &gHeaps[i].stats);
+
+      // the bins of other running threads change under us, their
+      // blocks count as used, and so do those on remote free lists
+      if (!walkable(&gHeaps[i]))
+	{
+	  continue;
+	}
+      for (cls = 0; cls < NUMSIZECLASSES; cls++)
+	{
+	  cached += stats_cached(cls, gHeaps[i].bins[cls].count);
+	}
+    }
+  pthread_mutex_unlock(&gHeapLock);
+
+  return stats_frontend(&front, backend, cached,
+			sizeof(gHeaps) + MAXPAGES * sizeof(page_owner_t),
+			0);
+}
+
+void
+kma_heap_walk(kma_walk_fn fn, void* arg)
+{
+  cached_block_t* block;
+  void** cached = NULL;
+  int count = 0, size = 0;
+  int i, cls;
+
+  // the blocks in the bins and on the remote free lists of the heaps
+  // that no other thread changes while gHeapLock is held
+  pthread_mutex_lock(&gHeapLock);
+  for (i = 0; i < TCACHE_MAXHEAPS; i++)
+    {
+      if (!walkable(&gHeaps[i]))
+	{
+	  continue;
+	}
+      for (cls = 0; cls < NUMSIZECLASSES; cls++)
+	{
+	  for (block = gHeaps[i].bins[cls].head; block != NULL;
+	       block = block->next)
+	    {
+	      cached = addBlock(cached, &count, &size, block);
+	    }
+	}
+      // other threads only push, which leaves the rest of the list be
+      for (block = __atomic_load_n(&gHeaps[i].remote, __ATOMIC_ACQUIRE);
+	   block != NULL; block = block->next)
+	{
+	  cached = addBlock(cached, &count, &size, block);
+	}
+    }
+  pthread_mutex_unlock(&gHeapLock);
+
+  pthread_mutex_lock(&gBackendLock);
+  stats_frontend_walk(fn, arg, cached, count);
+  pthread_mutex_unlock(&gBackendLock);
+
+  free(cached);
+}
+
+/* Whether the bins and remote free list of a heap hold still while
+ * gHeapLock is held: those of the calling thread, and those of
+ * abandoned heaps, which are only adopted and drained under the lock */
+static int
+walkable(tcache_t* heap)
+{
+  return heap == gHeap || heap->state == ABANDONED;
+}
+
+// appends a block to a growing array
+static void**
+addBlock(void** blocks, int* count, int* size, void* block)
+{
+  if (*count == *size)
+    {
+      *size = (*size > 0) ? 2 * *size : 1024;
+      blocks = realloc(blocks, *size * sizeof(void*));
+      assert(blocks != NULL);
+    }
+  blocks[(*count)++] = block;
+  return blocks;
+}
+
+static int
+batchSize(int cls)
+{
+  int count = TCACHE_BATCH_BYTES / class_size(cls);
+
+  if (count > TCACHE_BATCH)
+    {
+      return TCACHE_BATCH;
+    }
+  return count > 0 ? count : 1;
+}
+
+static tcache_t*
+adoptHeap()
+{
+  tcache_t* heap = NULL;
+  int i;
+
+  pthread_once(&gKeyOnce, createKey);
+
+  // prefer an abandoned heap, so its remote frees come back into use
+  pthread_mutex_lock(&gHeapLock);
+  for (i = 0; i < TCACHE_MAXHEAPS; i++)
+    {
+      if (gHeaps[i].state == ABANDONED)
+	{
+	  heap = &gHeaps[i];
+	  break;
+	}
+      if (gHeaps[i].state == UNUSED && heap == NULL)
+	{
+	  heap = &gHeaps[i];
+	}
+    }
+  if (heap == NULL)
+    {
+      pthread_mutex_unlock(&gHeapLock);
+      error("too many threads for the thread cache", "");
+    }
+  heap->state = ACTIVE;
+  pthread_mutex_unlock(&gHeapLock);
+
+  // make sure the cache is flushed when the thread exits
+  pthread_setspecific(gKey, heap);
+  gHeap = heap;
+
+  return heap;
+}
+
+static void
+pushBlock(tcache_t* heap, void* ptr, int cls)
+{
+  tcache_bin_t* bin = &heap->bins[cls];
+  cached_block_t* block = (cached_block_t*) ptr;
+
+  block->next = bin->head;
+  bin->head = block;
+  bin->count++;
+
+  if (bin->count > 2 * batchSize(cls))
+    {
+      flush(bin, cls, batchSize(cls));
+    }
+}
+
+static void
+remoteFree(tcache_t* owner, void* ptr, int cls)
+{
+  cached_block_t* block = (cached_block_t*) ptr;
+
+  block->cls = cls;
+  block->next = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&owner->remote, &block->next, block, 1,
+				      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+static void
+collectRemote(tcache_t* heap)
+{
+  cached_block_t* block;
+  cached_block_t* next;
+
+  if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) == NULL)
+    {
+      return;
+    }
+
+  // take the whole list at once, single pops would be open to ABA
+  block = __atomic_exchange_n(&heap->remote, NULL, __ATOMIC_ACQUIRE);
+  while (block != NULL)
+    {
+      next = block->next;
+      pushBlock(heap, block, block->cls);
+      block = next;
+    }
+}
+
+static void
+refill(tcache_t* heap, int cls)
+{
+  tcache_bin_t* bin = &heap->bins[cls];
+  cached_block_t* block;
+  int count = batchSize(cls);
+  int i, page;
+
+  INSTR_START(start);
+  pthread_mutex_lock(&gBackendLock);
+  if (gPages == NULL)
+    {
+      gPages = page_table(sizeof(page_owner_t));
+    }
+  for (i = 0; i < count; i++)
+    {
+      block = (cached_block_t*) stats_backend_block(cls);
+      if (block == NULL)
+	{
+	  break;
+	}
+
+      page = page_index(block);
+      if (gPages[page].blocks++ == 0)
+	{
+	  __atomic_store_n(&gPages[page].owner, heap, __ATOMIC_RELAXED);
+	}
+      else if (gPages[page].owner != heap)
+	{
+	  __atomic_store_n(&gPages[page].owner, SHARED, __ATOMIC_RELAXED);
+	}
+
+      block->next = bin->head;
+      bin->head = block;
+      bin->count++;
+    }
+  INSTR_END(KMA_EV_REFILL, start);
+  pthread_mutex_unlock(&gBackendLock);
+}
+
+static void
+flush(tcache_bin_t* bin, int cls, int count)
+{
+  cached_block_t* block;
+  kma_size_t size = class_size(cls);
+  int page;
+
+  assert(count <= bin->count);
+
+  INSTR_START(start);
+  pthread_mutex_lock(&gBackendLock);
+  while (count-- > 0)
+    {
+      block = bin->head;
+      bin->head = block->next;
+      bin->count--;
+
+      // the backend may release the page once it has all its blocks
+      page = page_index(block);
+      assert(gPages[page].blocks > 0);
+      if (--gPages[page].blocks == 0)
+	{
+	  __atomic_store_n(&gPages[page].owner, NULL, __ATOMIC_RELAXED);
+	}
+
+      kma_backend_free(block, size);
+    }
+  INSTR_END(KMA_EV_FLUSH, start);
+  pthread_mutex_unlock(&gBackendLock);
+}
+
+static void
+flushHeap(tcache_t* heap)
+{
+  int cls;
+
+  collectRemote(heap);
+
+  for (cls = 0; cls < NUMSIZECLASSES; cls++)
+    {
+      if (heap->bins[cls].count > 0)
+	{
+	  flush(&heap->bins[cls], cls, heap->bins[cls].count);
+	}
+    }
+}
+
+/* Hands the pages of a heap whose thread exits to nobody in
+ * particular, so that their blocks are no longer freed to a heap that
+ * does not allocate */
+static void
+disownPages(tcache_t* heap)
+{
+  pthread_mutex_lock(&gBackendLock);
+  if (gPages != NULL)
+    {
+      page_walk(disownPage, heap);
+    }
+  pthread_mutex_unlock(&gBackendLock);
+}
+
+// gives up the pages of a run that the heap owns
+static void
+disownPage(void* ptr, int count, void* heap)
+{
+  page_owner_t* page = &gPages[page_index(ptr)];
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      if (page[i].owner == heap)
+	{
+	  __atomic_store_n(&page[i].owner, SHARED, __ATOMIC_RELAXED);
+	}
+    }
+}
+
+static void
+createKey()
+{
+  pthread_key_create(&gKey, threadExit);
+}
+
+static void
+threadExit(void* cache)
+{
+  tcache_t* heap = (tcache_t*) cache;
+
+  assert(heap == gHeap);
+  disownPages(heap);
+  flushHeap(heap);
+
+  pthread_mutex_lock(&gHeapLock);
+  heap->state = ABANDONED;
+  pthread_mutex_unlock(&gHeapLock);
+
+  gHeap = NULL;
+}
+
+#endif // KMA_TCACHE
@@ -0,0 +1,60 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Interface of the per-thread cache front end
+ ***************************************************************************/
+
+#ifndef __KMA_TCACHE_H__
+#define __KMA_TCACHE_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Requests up to MAXCLASSSIZE bytes are rounded up to their size
+ * class (see kma_class.h) and served from a thread-local LIFO stack
+ * per class. Larger requests go straight to the backend. */
+
+/* Refills and flushes move a batch of blocks under a single backend
+ * lock: TCACHE_BATCH blocks, but no more than TCACHE_BATCH_BYTES worth
+ * of them (and at least one). A stack holds at most two batches. */
+#define TCACHE_BATCH 32
+#define TCACHE_BATCH_BYTES 16384
+
+/* Every page is owned by the first thread cache that refilled from it.
+ * A thread freeing a block of a page it does not own pushes the block
+ * onto the owner's remote free list with a single CAS; the owner takes
+ * the whole list with one exchange on its next malloc slow path. The
+ * caches live in a table of TCACHE_MAXHEAPS entries that is reused as
+ * threads come and go. */
+#define TCACHE_MAXHEAPS 256
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Flushes the thread cache
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns all blocks cached by the calling thread, and
+ *             those freed remotely to exited threads, to the backend.
+ *             Threads flush automatically when they exit, the main
+ *             thread should call this before it checks the page
+ *             statistics
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+void kma_tcache_flush();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_TCACHE_H__ */
@@ -0,0 +1,795 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Reading and writing of allocation traces
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "kma_trace.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* records buffered when a binary trace is read from a pipe */
+#define TRACE_BUFFER 4096
+
+struct trace
+{
+  enum TRACE_FORMAT format;
+  int n_ids;
+
+  // text traces, and traces read from stdin or a pipe
+  FILE* file;
+  int piped;		// opened with popen()
+  uint64_t remaining;	// records not yet buffered, ops not yet decoded
+  trace_rec_t* buffer;
+
+  // binary traces, mapped or buffered
+  void* map;
+  size_t map_size;
+  trace_rec_t* next;
+  trace_rec_t* end;
+
+  // compressed traces, decoded one block at a time
+  trace_zheader_t zheader;
+  unsigned char* block;
+  size_t block_size;
+  unsigned char* pos;
+  uint32_t block_left;	// ops left in the block
+  long last_id;		// of the last REQUEST
+};
+
+struct trace_writer
+{
+  enum TRACE_FORMAT format;
+  FILE* file;
+  trace_header_t header;
+
+  // compressed traces
+  trace_zheader_t zheader;
+  unsigned char* block;
+  size_t block_len;
+  uint32_t block_ops;
+  long last_id;
+  trace_index_t* index;
+  uint64_t index_size;
+};
+
+/* a varint is at most 10 bytes, an op at most three of them */
+#define MAXOPBYTES 30
+
+/************Global Variables*********************************************/
+
+// compressed traces are read through a pipe from these commands
+static const struct
+{
+  char* suffix;
+  char* command;
+} kDecompressors[] =
+  {
+    { ".gz",  "gzip -dc"  },
+    { ".bz2", "bzip2 -dc" },
+    { ".xz",  "xz -dc"    },
+    { ".zst", "zstd -dc"  },
+    { NULL,   NULL        }
+  };
+
+/************Function Prototypes******************************************/
+static int nextText(trace_t*, trace_op_t*);
+static int nextCompressed(trace_t*, trace_op_t*);
+static int fillBuffer(trace_t*);
+static int readBlock(trace_t*);
+static void mapBinary(trace_t*, int, char*);
+static void openStream(trace_t*, char*);
+static void checkHeader(trace_header_t*, char*);
+static void writeBlock(trace_writer_t*);
+static unsigned char* putVarint(unsigned char*, uint64_t);
+static uint64_t getVarint(unsigned char**, unsigned char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+trace_t*
+trace_open(char* path)
+{
+  trace_t* trace = calloc(1, sizeof(trace_t));
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  char* command;
+  size_t len;
+  int fd, i;
+
+  assert(trace != NULL);
+
+  if (strcmp(path, "-") == 0)
+    {
+      trace->file = stdin;
+      openStream(trace, path);
+      return trace;
+    }
+
+  for (i = 0; kDecompressors[i].suffix != NULL; i++)
+    {
+      len = strlen(kDecompressors[i].suffix);
+      if (strlen(path) > len
+	  && strcmp(path + strlen(path) - len, kDecompressors[i].suffix) == 0)
+	{
+	  if (strchr(path, '\'') != NULL)
+	    {
+	      error("unsupported character in trace path", path);
+	    }
+	  command = malloc(strlen(kDecompressors[i].command) + strlen(path) + 8);
+	  assert(command != NULL);
+	  sprintf(command, "%s -- '%s'", kDecompressors[i].command, path);
+
+	  trace->file = popen(command, "r");
+	  free(command);
+	  if (trace->file == NULL)
+	    {
+	      error("unable to start decompressor for", path);
+	    }
+	  trace->piped = 1;
+	  openStream(trace, path);
+	  return trace;
+	}
+    }
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    {
+      error("unable to open input test file", path);
+    }
+
+  if (read(fd, magic, sizeof(magic)) == sizeof(magic)
+      && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0)
+    {
+      mapBinary(trace, fd, path);
+      close(fd);
+      return trace;
+    }
+
+  close(fd);
+
+  trace->file = fopen(path, "r");
+  if (trace->file == NULL)
+    {
+      error("unable to open input test file", path);
+    }
+  openStream(trace, path);
+
+  return trace;
+}
+
+int
+trace_ids(trace_t* trace)
+{
+  return trace->n_ids;
+}
+
+int
+trace_next(trace_t* trace, trace_op_t* op)
+{
+  trace_rec_t* rec;
+
+  if (trace->format == TRACE_TEXT)
+    {
+      return nextText(trace, op);
+    }
+  if (trace->format == TRACE_COMPRESSED)
+    {
+      return nextCompressed(trace, op);
+    }
+
+  if (trace->next == trace->end && !fillBuffer(trace))
+    {
+      return 0;
+    }
+
+  rec = trace->next++;
+  op->type = rec->op;
+  op->id = rec->id;
+  op->size = rec->size;
+  op->tid = (rec->tid == TRACE_NO_TID) ? -1 : rec->tid;
+
+  return 1;
+}
+
+void
+trace_seek(trace_t* trace, uint64_t op)
+{
+  trace_index_t entry, best;
+  trace_op_t skipped;
+  uint64_t lo, hi, mid;
+
+  if (trace->format == TRACE_BINARY && trace->map != NULL)
+    {
+      trace->next = (trace_rec_t*) ((trace_header_t*) trace->map + 1);
+      if (op > (uint64_t) (trace->end - trace->next))
+	{
+	  error("seek past the end of the trace", "");
+	}
+      trace->next += op;
+      return;
+    }
+
+  if (!trace_seekable(trace))
+    {
+      error("trace cannot seek", "");
+    }
+  if (op > trace->zheader.count)
+    {
+      error("seek past the end of the trace", "");
+    }
+
+  // last block that starts at or before the op
+  best.offset = sizeof(trace_zheader_t);
+  best.first = 0;
+  lo = 0;
+  hi = trace->zheader.n_blocks;
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (fseek(trace->file, trace->zheader.index_offset
+		+ mid * sizeof(trace_index_t), SEEK_SET) != 0
+	  || fread(&entry, sizeof(entry), 1, trace->file) != 1)
+	{
+	  error("unable to read trace index", "");
+	}
+      if (entry.first <= op)
+	{
+	  best = entry;
+	  lo = mid + 1;
+	}
+      else
+	{
+	  hi = mid;
+	}
+    }
+
+  if (fseek(trace->file, best.offset, SEEK_SET) != 0)
+    {
+      error("unable to seek in trace", "");
+    }
+  trace->block_left = 0;
+  trace->remaining = trace->zheader.count - best.first;
+
+  while (best.first++ < op)
+    {
+      nextCompressed(trace, &skipped);
+    }
+}
+
+int
+trace_seekable(trace_t* trace)
+{
+  if (trace->format == TRACE_BINARY)
+    {
+      return trace->map != NULL;
+    }
+  return trace->format == TRACE_COMPRESSED && !trace->piped
+    && trace->file != stdin && trace->zheader.index_offset != 0;
+}
+
+void
+trace_close(trace_t* trace)
+{
+  if (trace->piped)
+    {
+      pclose(trace->file);
+    }
+  else if (trace->file != NULL && trace->file != stdin)
+    {
+      fclose(trace->file);
+    }
+  free(trace->buffer);
+  free(trace->block);
+  if (trace->map != NULL)
+    {
+      munmap(trace->map, trace->map_size);
+    }
+  free(trace);
+}
+
+trace_writer_t*
+trace_create(char* path, int n_ids, enum TRACE_FORMAT format)
+{
+  trace_writer_t* writer = calloc(1, sizeof(trace_writer_t));
+  size_t written = 1;
+
+  assert(writer != NULL);
+
+  writer->format = format;
+  writer->file = fopen(path, "wb");
+  if (writer->file == NULL)
+    {
+      error("unable to create trace file", path);
+    }
+
+  // the counts and flags are filled in by trace_finish
+  switch (format)
+    {
+    case TRACE_TEXT:
+      fprintf(writer->file, "%d\n", n_ids);
+      break;
+    case TRACE_BINARY:
+      memcpy(writer->header.magic, TRACE_MAGIC, sizeof(writer->header.magic));
+      writer->header.version = TRACE_VERSION;
+      writer->header.rec_size = sizeof(trace_rec_t);
+      writer->header.n_ids = n_ids;
+      written = fwrite(&writer->header, sizeof(trace_header_t), 1,
+		       writer->file);
+      break;
+    case TRACE_COMPRESSED:
+      memcpy(writer->zheader.magic, TRACE_ZMAGIC,
+	     sizeof(writer->zheader.magic));
+      writer->zheader.version = TRACE_ZVERSION;
+      writer->zheader.block_ops = TRACE_BLOCK_OPS;
+      writer->zheader.n_ids = n_ids;
+      written = fwrite(&writer->zheader, sizeof(trace_zheader_t), 1,
+		       writer->file);
+      writer->block = malloc(TRACE_BLOCK_OPS * MAXOPBYTES);
+      assert(writer->block != NULL);
+      break;
+    }
+
+  if (written != 1)
+    {
+      error("unable to write trace file", path);
+    }
+
+  return writer;
+}
+
+void
+trace_write(trace_writer_t* writer, trace_op_t* op)
+{
+  unsigned char* pos;
+  trace_rec_t rec;
+  uint64_t delta;
+
+  if (op->tid >= 0)
+    {
+      writer->header.flags |= TRACE_HAS_TID;
+      writer->zheader.flags |= TRACE_HAS_TID;
+    }
+
+  switch (writer->format)
+    {
+    case TRACE_TEXT:
+      if (op->type == TRACE_REQUEST)
+	{
+	  fprintf(writer->file, "REQUEST %ld %d", op->id, op->size);
+	}
+      else
+	{
+	  fprintf(writer->file, "FREE %ld", op->id);
+	}
+      if (op->tid >= 0)
+	{
+	  fprintf(writer->file, " %d", op->tid);
+	}
+      fprintf(writer->file, "\n");
+      break;
+
+    case TRACE_BINARY:
+      memset(&rec, 0, sizeof(rec));
+      rec.op = op->type;
+      rec.id = op->id;
+      rec.size = (op->type == TRACE_REQUEST) ? op->size : 0;
+      rec.tid = (op->tid >= 0) ? op->tid : TRACE_NO_TID;
+      if (fwrite(&rec, sizeof(rec), 1, writer->file) != 1)
+	{
+	  error("unable to write trace file", "");
+	}
+      writer->header.count++;
+      break;
+
+    case TRACE_COMPRESSED:
+      // zigzag, so small negative deltas stay small
+      delta = (uint64_t) (op->id - writer->last_id);
+      delta = (delta << 1) ^ (uint64_t) ((op->id - writer->last_id) >> 63);
+
+      pos = writer->block + writer->block_len;
+      pos = putVarint(pos, (delta << 2) | ((op->tid >= 0) << 1) | op->type);
+      if (op->type == TRACE_REQUEST)
+	{
+	  pos = putVarint(pos, op->size);
+	  writer->last_id = op->id;
+	}
+      if (op->tid >= 0)
+	{
+	  pos = putVarint(pos, op->tid);
+	}
+      writer->block_len = pos - writer->block;
+
+      writer->zheader.count++;
+      if (++writer->block_ops == TRACE_BLOCK_OPS)
+	{
+	  writeBlock(writer);
+	}
+      break;
+    }
+}
+
+void
+trace_finish(trace_writer_t* writer)
+{
+  int failed = 0;
+  long offset;
+
+  switch (writer->format)
+    {
+    case TRACE_TEXT:
+      break;
+    case TRACE_BINARY:
+      failed = fseek(writer->file, 0, SEEK_SET) != 0
+	|| fwrite(&writer->header, sizeof(trace_header_t), 1,
+		  writer->file) != 1;
+      break;
+    case TRACE_COMPRESSED:
+      if (writer->block_ops > 0)
+	{
+	  writeBlock(writer);
+	}
+      offset = ftell(writer->file);
+      writer->zheader.index_offset = offset;
+      failed = offset < 0
+	|| fwrite(writer->index, sizeof(trace_index_t),
+		  writer->zheader.n_blocks, writer->file)
+	   != writer->zheader.n_blocks
+	|| fseek(writer->file, 0, SEEK_SET) != 0
+	|| fwrite(&writer->zheader, sizeof(trace_zheader_t), 1,
+		  writer->file) != 1;
+      break;
+    }
+
+  if (fclose(writer->file) != 0 || failed)
+    {
+      error("unable to write trace file", "");
+    }
+  free(writer->block);
+  free(writer->index);
+  free(writer);
+}
+
+static int
+nextText(trace_t* trace, trace_op_t* op)
+{
+  char line[128];
+  char command[16];
+  int fields, arg;
+
+  while (fgets(line, sizeof(line), trace->file) != NULL)
+    {
+      fields = sscanf(line, "%15s %ld %d %d",
+		      command, &op->id, &op->size, &arg);
+      if (fields < 1)
+	{
+	  continue;
+	}
+
+      if (strcmp(command, "REQUEST") == 0)
+	{
+	  if (fields < 3)
+	    error("Not enough arguments to REQUEST", "");
+
+	  op->type = TRACE_REQUEST;
+	  op->tid = (fields > 3) ? arg : -1;
+	}
+      else if (strcmp(command, "FREE") == 0)
+	{
+	  if (fields < 2)
+	    error("Not enough arguments to FREE", "");
+
+	  // the thread id is the third field of a FREE
+	  op->type = TRACE_FREE;
+	  op->tid = (fields > 2) ? op->size : -1;
+	  op->size = 0;
+	}
+      else
+	{
+	  error("unknown command type:", command);
+	}
+
+      return 1;
+    }
+
+  return 0;
+}
+
+static int
+nextCompressed(trace_t* trace, trace_op_t* op)
+{
+  unsigned char* end;
+  uint64_t word, delta;
+
+  if (trace->block_left == 0 && !readBlock(trace))
+    {
+      return 0;
+    }
+
+  end = trace->block + trace->block_size;
+  word = getVarint(&trace->pos, end);
+  delta = word >> 2;
+
+  op->type = word & 1;
+  op->id = trace->last_id + (long) ((delta >> 1) ^ -(delta & 1));
+  op->size = 0;
+  op->tid = -1;
+  if (op->type == TRACE_REQUEST)
+    {
+      op->size = getVarint(&trace->pos, end);
+      trace->last_id = op->id;
+    }
+  if (word & 2)
+    {
+      op->tid = getVarint(&trace->pos, end);
+    }
+
+  trace->block_left--;
+  trace->remaining--;
+  return 1;
+}
+
+static int
+readBlock(trace_t* trace)
+{
+  trace_block_t frame;
+
+  // the index follows the last block
+  if (trace->remaining == 0)
+    {
+      return 0;
+    }
+
+  if (fread(&frame, sizeof(frame), 1, trace->file) != 1)
+    {
+      error("truncated trace", "");
+    }
+  if (frame.sync != TRACE_SYNC || frame.ops == 0
+      || frame.ops > trace->remaining)
+    {
+      error("corrupt trace block", "");
+    }
+
+  if (frame.bytes > trace->block_size || trace->block == NULL)
+    {
+      free(trace->block);
+      trace->block = malloc(frame.bytes);
+      assert(trace->block != NULL);
+    }
+  trace->block_size = frame.bytes;
+  if (fread(trace->block, 1, frame.bytes, trace->file) != frame.bytes)
+    {
+      error("truncated trace", "");
+    }
+
+  trace->pos = trace->block;
+  trace->block_left = frame.ops;
+  trace->last_id = 0;
+  return 1;
+}
+
+static int
+fillBuffer(trace_t* trace)
+{
+  size_t want, got;
+
+  if (trace->file == NULL || trace->remaining == 0)
+    {
+      return 0;
+    }
+
+  want = (trace->remaining < TRACE_BUFFER) ? trace->remaining : TRACE_BUFFER;
+  got = fread(trace->buffer, sizeof(trace_rec_t), want, trace->file);
+  if (got == 0)
+    {
+      error("truncated trace", "");
+    }
+
+  trace->remaining -= got;
+  trace->next = trace->buffer;
+  trace->end = trace->buffer + got;
+  return 1;
+}
+
+static void
+openStream(trace_t* trace, char* path)
+{
+  trace_header_t header;
+  int c;
+
+  // a text trace starts with its id count, the others with a magic
+  c = getc(trace->file);
+  ungetc(c, trace->file);
+
+  if (c != TRACE_MAGIC[0])
+    {
+      trace->format = TRACE_TEXT;
+
+      // Get the number of requests in the trace file
+      if (fscanf(trace->file, "%d\n", &trace->n_ids) != 1)
+	{
+	  error("Couldn't read number of requests at head of file", "");
+	}
+      return;
+    }
+
+  if (fread(&header, sizeof(header.magic), 1, trace->file) != 1)
+    {
+      error("truncated trace header", path);
+    }
+
+  if (memcmp(header.magic, TRACE_ZMAGIC, sizeof(header.magic)) == 0)
+    {
+      memcpy(trace->zheader.magic, header.magic, sizeof(header.magic));
+      if (fread(trace->zheader.magic + sizeof(header.magic),
+		sizeof(trace_zheader_t) - sizeof(header.magic), 1,
+		trace->file) != 1)
+	{
+	  error("truncated trace header", path);
+	}
+      if (trace->zheader.version != TRACE_ZVERSION
+	  || trace->zheader.n_ids > INT_MAX)
+	{
+	  error("unsupported trace version or byte order", path);
+	}
+
+      trace->format = TRACE_COMPRESSED;
+      trace->n_ids = trace->zheader.n_ids;
+      trace->remaining = trace->zheader.count;
+      return;
+    }
+
+  if (fread(header.magic + sizeof(header.magic),
+	    sizeof(header) - sizeof(header.magic), 1, trace->file) != 1)
+    {
+      error("truncated trace header", path);
+    }
+  checkHeader(&header, path);
+
+  trace->format = TRACE_BINARY;
+  trace->n_ids = header.n_ids;
+  trace->remaining = header.count;
+  trace->buffer = malloc(TRACE_BUFFER * sizeof(trace_rec_t));
+  assert(trace->buffer != NULL);
+}
+
+static void
+checkHeader(trace_header_t* header, char* path)
+{
+  if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0)
+    {
+      error("not a trace", path);
+    }
+  if (header->version != TRACE_VERSION
+      || header->rec_size != sizeof(trace_rec_t))
+    {
+      error("unsupported trace version or byte order", path);
+    }
+  if (header->n_ids > INT_MAX)
+    {
+      error("too many ids in trace", path);
+    }
+}
+
+static void
+mapBinary(trace_t* trace, int fd, char* path)
+{
+  trace_header_t* header;
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(trace_header_t))
+    {
+      error("truncated trace header", path);
+    }
+
+  trace->map_size = st.st_size;
+  trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (trace->map == MAP_FAILED)
+    {
+      error("unable to map trace file", path);
+    }
+  madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+
+  header = (trace_header_t*) trace->map;
+  checkHeader(header, path);
+  if (sizeof(trace_header_t) + header->count * sizeof(trace_rec_t)
+      > trace->map_size)
+    {
+      error("truncated trace", path);
+    }
+
+  trace->format = TRACE_BINARY;
+  trace->n_ids = header->n_ids;
+  trace->next = (trace_rec_t*) (header + 1);
+  trace->end = trace->next + header->count;
+}
+
+static void
+writeBlock(trace_writer_t* writer)
+{
+  trace_block_t frame;
+  long offset = ftell(writer->file);
+
+  if (writer->zheader.n_blocks == writer->index_size)
+    {
+      writer->index_size = writer->index_size ? 2 * writer->index_size : 64;
+      writer->index = realloc(writer->index,
+			      writer->index_size * sizeof(trace_index_t));
+      assert(writer->index != NULL);
+    }
+
+  memset(&frame, 0, sizeof(frame));
+  frame.sync = TRACE_SYNC;
+  frame.bytes = writer->block_len;
+  frame.ops = writer->block_ops;
+  frame.first = writer->zheader.count - writer->block_ops;
+
+  writer->index[writer->zheader.n_blocks].offset = offset;
+  writer->index[writer->zheader.n_blocks].first = frame.first;
+  writer->zheader.n_blocks++;
+
+  if (offset < 0
+      || fwrite(&frame, sizeof(frame), 1, writer->file) != 1
+      || fwrite(writer->block, 1, writer->block_len, writer->file)
+	 != writer->block_len)
+    {
+      error("unable to write trace file", "");
+    }
+
+  // every block decodes on its own
+  writer->block_len = 0;
+  writer->block_ops = 0;
+  writer->last_id = 0;
+}
+
+static unsigned char*
+putVarint(unsigned char* pos, uint64_t value)
+{
+  while (value >= 0x80)
+    {
+      *pos++ = (unsigned char) value | 0x80;
+      value >>= 7;
+    }
+  *pos++ = (unsigned char) value;
+  return pos;
+}
+
+static uint64_t
+getVarint(unsigned char** pos, unsigned char* end)
+{
+  uint64_t value = 0;
+  int shift = 0;
+  unsigned char byte;
+
+  do
+    {
+      if (*pos == end || shift > 63)
+	{
+	  error("corrupt trace block", "");
+	}
+      byte = *(*pos)++;
+      value |= (uint64_t) (byte & 0x7f) << shift;
+      shift += 7;
+    }
+  while (byte & 0x80);
+
+  return value;
+}
@@ -0,0 +1,227 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Reading and writing of allocation traces
+ ***************************************************************************/
+
+#ifndef __KMA_TRACE_H__
+#define __KMA_TRACE_H__
+
+/************System include***********************************************/
+#include <stdio.h>
+#include <stdint.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* A trace is either text, as produced by generate_trace:
+ *
+ *   <number of ids>
+ *   REQUEST <id> <size> [<thread>]
+ *   FREE <id> [<thread>]
+ *
+ * or binary: a trace_header_t followed by count fixed-size records in
+ * host byte order. Binary traces are mapped into memory and replayed
+ * without any parsing.
+ *
+ * or compressed: a trace_zheader_t followed by blocks of at most
+ * block_ops ops, each a trace_block_t frame and its payload, and an
+ * index of the blocks at index_offset. Every block decodes on its own.
+ * An op is a varint of the zigzag delta of its id to the previous
+ * REQUEST id (0 at the start of a block), shifted left by two, with
+ * the thread flag in bit 1 and the op in bit 0. It is followed by a
+ * varint size for a REQUEST and a varint thread id if flagged. */
+#define TRACE_MAGIC "KMATRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_ZMAGIC "KMATRACZ"
+#define TRACE_ZVERSION 1
+#define TRACE_SYNC 0x4b4c424b	// "KBLK"
+#define TRACE_BLOCK_OPS 4096
+
+// header flags
+#define TRACE_HAS_TID 0x1
+
+// thread of records without a thread id
+#define TRACE_NO_TID 0xffff
+
+enum TRACE_OP
+  {
+    TRACE_REQUEST,
+    TRACE_FREE
+  };
+
+enum TRACE_FORMAT
+  {
+    TRACE_TEXT,
+    TRACE_BINARY,
+    TRACE_COMPRESSED
+  };
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t rec_size;	// sizeof(trace_rec_t)
+  uint32_t n_ids;	// ids are below this
+  uint64_t count;	// number of records
+} trace_header_t;
+
+typedef struct
+{
+  uint8_t op;
+  uint8_t pad;
+  uint16_t tid;
+  uint32_t size;	// 0 for TRACE_FREE
+  uint64_t id;
+} trace_rec_t;
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t block_ops;	// ops per block, the last one may have fewer
+  uint32_t n_ids;
+  uint64_t count;	// number of ops
+  uint64_t n_blocks;
+  uint64_t index_offset;	// n_blocks trace_index_t entries
+} trace_zheader_t;
+
+typedef struct
+{
+  uint32_t sync;	// TRACE_SYNC
+  uint32_t bytes;	// payload following the frame
+  uint32_t ops;
+  uint32_t pad;
+  uint64_t first;	// number of the first op
+} trace_block_t;
+
+typedef struct
+{
+  uint64_t offset;	// of the frame
+  uint64_t first;
+} trace_index_t;
+
+// one decoded trace line
+typedef struct
+{
+  enum TRACE_OP type;
+  long id;
+  int size;
+  int tid;		// -1 if the line has none
+} trace_op_t;
+
+typedef struct trace trace_t;
+typedef struct trace_writer trace_writer_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Opens a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Opens a text or binary trace, telling them apart by
+ *             the magic number. "-" reads from stdin, and paths
+ *             ending in .gz, .bz2, .xz or .zst are read through the
+ *             decompressor. Binary traces are mapped if they are
+ *             plain files and buffered otherwise. Errors are
+ *             reported through error()
+ *    Input: the path
+ *    Output: the trace
+ ***********************************************************************/
+trace_t* trace_open(char* path);
+
+/***********************************************************************
+ *  Title: Number of ids of a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Get the bound on the request ids from the trace header
+ *    Input: the trace
+ *    Output: all ids are below this
+ ***********************************************************************/
+int trace_ids(trace_t* trace);
+
+/***********************************************************************
+ *  Title: Reads the next operation
+ * ---------------------------------------------------------------------
+ *    Purpose: Decodes the next operation of a trace
+ *    Input: the trace and the operation to fill in
+ *    Output: 1 if an operation was read, 0 at the end of the trace
+ ***********************************************************************/
+int trace_next(trace_t* trace, trace_op_t* op);
+
+/***********************************************************************
+ *  Title: Seeks in a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Positions a binary or compressed trace file so that
+ *             trace_next() returns the given op. Compressed traces
+ *             jump to the block through the index and only decode
+ *             that block. Text traces and pipes cannot seek
+ *    Input: the trace and the number of the op
+ *    Output: none
+ ***********************************************************************/
+void trace_seek(trace_t* trace, uint64_t op);
+
+/***********************************************************************
+ *  Title: Whether a trace can seek
+ * ---------------------------------------------------------------------
+ *    Purpose: Says whether trace_seek() works on a trace, that is
+ *             whether it is a mapped binary file or a compressed file
+ *             with an index
+ *    Input: the trace
+ *    Output: 1 if it can seek, 0 otherwise
+ ***********************************************************************/
+int trace_seekable(trace_t* trace);
+
+/***********************************************************************
+ *  Title: Closes a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Unmaps or closes the trace and frees it
+ *    Input: the trace
+ *    Output: none
+ ***********************************************************************/
+void trace_close(trace_t* trace);
+
+/***********************************************************************
+ *  Title: Creates a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Starts writing a trace in the given format
+ *    Input: the path, the number of ids and the format
+ *    Output: the writer
+ ***********************************************************************/
+trace_writer_t* trace_create(char* path, int n_ids,
+			     enum TRACE_FORMAT format);
+
+/***********************************************************************
+ *  Title: Writes an operation
+ * ---------------------------------------------------------------------
+ *    Purpose: Appends one operation to a trace
+ *    Input: the writer and the operation
+ *    Output: none
+ ***********************************************************************/
+void trace_write(trace_writer_t* writer, trace_op_t* op);
+
+/***********************************************************************
+ *  Title: Finishes a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes the last block and the index, fills in the
+ *             counts and flags of the header, closes the file and
+ *             frees the writer
+ *    Input: the writer
+ *    Output: none
+ ***********************************************************************/
+void trace_finish(trace_writer_t* writer);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_TRACE_H__ */
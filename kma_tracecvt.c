@@ -0,0 +1,437 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Converts allocation traces between text and binary
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "kma_trace.h"
+#include "kma_capture.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+// a live block of a capture, ptr 0 if the slot is empty
+typedef struct
+{
+  uint64_t ptr;
+  long id;		// -1 for a block too large for a trace
+  int tid;
+} block_t;
+
+/************Global Variables*********************************************/
+
+static capture_rec_t* gRecs = NULL;
+static long* gOrder = NULL;	// of the records by time
+
+// the live blocks by address, open addressing
+static block_t* gBlocks = NULL;
+static long gNumBlocks = 0;
+static long gMask = 0;
+
+/************Function Prototypes******************************************/
+void convertCapture(char*, char*, enum TRACE_FORMAT);
+long readCapture(char*, capture_header_t*);
+block_t* findBlock(uint64_t);
+block_t* insertBlock(uint64_t);
+void removeBlock(block_t*);
+int compareRecs(const void*, const void*);
+int compareIds(const void*, const void*);
+void usage();
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+char *name = NULL;
+
+int
+main(int argc, char* argv[])
+{
+  enum TRACE_FORMAT format = TRACE_BINARY;
+  trace_writer_t* writer;
+  trace_t* trace;
+  trace_op_t op;
+  long first = 0, count = -1;
+  int capture = 0;
+  int opt;
+
+  name = argv[0];
+
+  while ((opt = getopt(argc, argv, "cdzs:n:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'c':
+	  capture = 1;
+	  break;
+	case 's':
+	  first = atol(optarg);
+	  break;
+	case 'n':
+	  count = atol(optarg);
+	  break;
+	case 'd':
+	  format = TRACE_TEXT;
+	  break;
+	case 'z':
+	  format = TRACE_COMPRESSED;
+	  break;
+	default:
+	  usage();
+	}
+    }
+
+  // captures are converted whole
+  if (optind != argc - 2 || first < 0
+      || (capture && (first > 0 || count >= 0)))
+    {
+      usage();
+    }
+
+  if (capture)
+    {
+      convertCapture(argv[optind], argv[optind + 1], format);
+      return 0;
+    }
+
+  // the input may be in any format
+  trace = trace_open(argv[optind]);
+  writer = trace_create(argv[optind + 1], trace_ids(trace), format);
+
+  // the ops before a slice are only read through where it cannot seek
+  if (first > 0 && trace_seekable(trace))
+    {
+      trace_seek(trace, first);
+    }
+  else
+    {
+      for (; first > 0 && trace_next(trace, &op); first--)
+	;
+    }
+
+  while (count-- != 0 && trace_next(trace, &op))
+    {
+      if (op.id < 0)
+	{
+	  error("request id out of range", argv[optind]);
+	}
+      if (op.tid >= TRACE_NO_TID)
+	{
+	  error("thread id out of range", argv[optind]);
+	}
+      trace_write(writer, &op);
+    }
+
+  trace_finish(writer);
+  trace_close(trace);
+  return 0;
+}
+
+/* Turns a capture of kma_capture.so into a trace. The records are put
+ * in time order, and every allocation gets the next id. Frees of
+ * blocks the capture did not see allocated (before the shim started,
+ * or by entry points it does not hook) are dropped, and blocks still
+ * live at the end are freed there, so that the harness can check for
+ * leaked pages. Requests of 0 bytes become 1 byte. */
+void
+convertCapture(char* in, char* out, enum TRACE_FORMAT format)
+{
+  capture_header_t header;
+  trace_writer_t* writer;
+  trace_op_t op;
+  capture_rec_t* rec;
+  block_t* block;
+  long* live;
+  long numRecs, numIds = 0, numLive = 0;
+  long unknown = 0, reused = 0, large = 0, threads = 0;
+  long i;
+
+  numRecs = readCapture(in, &header);
+  gOrder = malloc(numRecs * sizeof(long) + sizeof(long));
+  if (gOrder == NULL)
+    {
+      error("out of memory converting", in);
+    }
+  for (i = 0; i < numRecs; i++)
+    {
+      gOrder[i] = i;
+    }
+  qsort(gOrder, numRecs, sizeof(long), compareRecs);
+
+  for (i = 0; i < numRecs; i++)
+    {
+      if (gRecs[i].tid >= TRACE_NO_TID)
+	{
+	  error("thread id out of range", in);
+	}
+      if (gRecs[i].tid >= threads)
+	{
+	  threads = gRecs[i].tid + 1;
+	}
+      numIds += (gRecs[i].op != CAPTURE_FREE);
+    }
+
+  gMask = 1023;
+  gBlocks = calloc(gMask + 1, sizeof(block_t));
+  if (gBlocks == NULL)
+    {
+      error("out of memory converting", in);
+    }
+
+  writer = trace_create(out, numIds, format);
+  numIds = 0;
+  for (i = 0; i < numRecs; i++)
+    {
+      rec = &gRecs[gOrder[i]];
+      block = findBlock(rec->ptr);
+      op.tid = rec->tid;
+
+      if (rec->op == CAPTURE_FREE || block != NULL)
+	{
+	  if (block == NULL)
+	    {
+	      unknown++;
+	      continue;
+	    }
+	  // an allocation of a live block means that its free was missed
+	  reused += (rec->op != CAPTURE_FREE);
+	  if (block->id >= 0)
+	    {
+	      op.type = TRACE_FREE;
+	      op.id = block->id;
+	      op.size = 0;
+	      trace_write(writer, &op);
+	    }
+	  removeBlock(block);
+	  if (rec->op == CAPTURE_FREE)
+	    {
+	      continue;
+	    }
+	}
+
+      block = insertBlock(rec->ptr);
+      block->tid = rec->tid;
+      block->id = -1;
+      if (rec->size > INT_MAX)
+	{
+	  large++;
+	  continue;
+	}
+      block->id = numIds++;
+      op.type = TRACE_REQUEST;
+      op.id = block->id;
+      op.size = (rec->size > 0) ? rec->size : 1;
+      trace_write(writer, &op);
+    }
+
+  // free what is left in the order of allocation
+  live = malloc(gNumBlocks * sizeof(long) + sizeof(long));
+  if (live == NULL)
+    {
+      error("out of memory converting", in);
+    }
+  for (i = 0; i <= gMask; i++)
+    {
+      if (gBlocks[i].ptr != 0 && gBlocks[i].id >= 0)
+	{
+	  live[numLive++] = i;
+	}
+    }
+  qsort(live, numLive, sizeof(long), compareIds);
+  for (i = 0; i < numLive; i++)
+    {
+      op.type = TRACE_FREE;
+      op.id = gBlocks[live[i]].id;
+      op.size = 0;
+      op.tid = gBlocks[live[i]].tid;
+      trace_write(writer, &op);
+    }
+
+  trace_finish(writer);
+
+  printf("Capture of pid %u: %ld records of %ld threads over %.3f s\n",
+	 header.pid, numRecs, threads,
+	 (numRecs > 0) ? gRecs[gOrder[numRecs - 1]].time / 1e9 : 0.0);
+  printf("Trace: %ld requests, %ld freed at the end, %ld frees of unknown "
+	 "blocks dropped, %ld missed frees, %ld requests over INT_MAX "
+	 "dropped\n", numIds, numLive, unknown, reused, large);
+
+  free(live);
+  free(gBlocks);
+  free(gOrder);
+  free(gRecs);
+}
+
+long
+readCapture(char* path, capture_header_t* header)
+{
+  FILE* file = fopen(path, "rb");
+  long size, numRecs;
+
+  if (file == NULL)
+    {
+      error("unable to open capture", path);
+    }
+  if (fread(header, sizeof(capture_header_t), 1, file) != 1
+      || memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0
+      || header->version != CAPTURE_VERSION
+      || header->rec_size != sizeof(capture_rec_t))
+    {
+      error("not a capture of this version", path);
+    }
+
+  fseek(file, 0, SEEK_END);
+  size = ftell(file) - sizeof(capture_header_t);
+  fseek(file, sizeof(capture_header_t), SEEK_SET);
+
+  // a partly written last record is cut off
+  numRecs = size / sizeof(capture_rec_t);
+  gRecs = malloc(numRecs * sizeof(capture_rec_t) + sizeof(capture_rec_t));
+  if (gRecs == NULL)
+    {
+      error("out of memory reading", path);
+    }
+  if (fread(gRecs, sizeof(capture_rec_t), numRecs, file) != numRecs)
+    {
+      error("unable to read capture", path);
+    }
+
+  fclose(file);
+  return numRecs;
+}
+
+block_t*
+findBlock(uint64_t ptr)
+{
+  long i = (ptr * 0x9E3779B97F4A7C15ULL) >> 20 & gMask;
+
+  while (gBlocks[i].ptr != 0)
+    {
+      if (gBlocks[i].ptr == ptr)
+	{
+	  return &gBlocks[i];
+	}
+      i = (i + 1) & gMask;
+    }
+  return NULL;
+}
+
+// the table grows at half full
+block_t*
+insertBlock(uint64_t ptr)
+{
+  block_t* old = gBlocks;
+  long oldMask = gMask;
+  long i;
+
+  if (2 * (gNumBlocks + 1) > gMask + 1)
+    {
+      gMask = 2 * gMask + 1;
+      gBlocks = calloc(gMask + 1, sizeof(block_t));
+      if (gBlocks == NULL)
+	{
+	  error("out of memory converting", "");
+	}
+      gNumBlocks = 0;
+      for (i = 0; i <= oldMask; i++)
+	{
+	  if (old[i].ptr != 0)
+	    {
+	      *insertBlock(old[i].ptr) = old[i];
+	    }
+	}
+      free(old);
+    }
+
+  i = (ptr * 0x9E3779B97F4A7C15ULL) >> 20 & gMask;
+  while (gBlocks[i].ptr != 0)
+    {
+      i = (i + 1) & gMask;
+    }
+  gBlocks[i].ptr = ptr;
+  gNumBlocks++;
+  return &gBlocks[i];
+}
+
+// moves later blocks of the probe sequence back into the gap
+void
+removeBlock(block_t* block)
+{
+  long gap = block - gBlocks;
+  long i = gap, home;
+
+  for (;;)
+    {
+      i = (i + 1) & gMask;
+      if (gBlocks[i].ptr == 0)
+	{
+	  break;
+	}
+      home = (gBlocks[i].ptr * 0x9E3779B97F4A7C15ULL) >> 20 & gMask;
+      // whether home lies cyclically in (gap, i]
+      if ((i > gap) ? (home <= gap || home > i) : (home <= gap && home > i))
+	{
+	  gBlocks[gap] = gBlocks[i];
+	  gap = i;
+	}
+    }
+  gBlocks[gap].ptr = 0;
+  gNumBlocks--;
+}
+
+// by time, and in the order of the file for equal times
+int
+compareRecs(const void* a, const void* b)
+{
+  long x = *(long*) a;
+  long y = *(long*) b;
+
+  if (gRecs[x].time != gRecs[y].time)
+    {
+      return (gRecs[x].time > gRecs[y].time)
+	- (gRecs[x].time < gRecs[y].time);
+    }
+  return (x > y) - (x < y);
+}
+
+int
+compareIds(const void* a, const void* b)
+{
+  long x = gBlocks[*(long*) a].id;
+  long y = gBlocks[*(long*) b].id;
+
+  return (x > y) - (x < y);
+}
+
+void
+usage()
+{
+  printf("Usage: %s [-c] [-d | -z] [-s first] [-n count] inputTrace "
+	 "outputTrace\n", name);
+  printf("Writes a binary trace, a text trace with -d, or a compressed\n");
+  printf("trace with -z. With -c the input is a capture of kma_capture.so\n");
+  printf("-s and -n write only count ops from op first on. Such a slice\n");
+  printf("is for looking at, its frees may refer to earlier requests\n");
+  exit(0);
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
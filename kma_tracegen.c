@@ -0,0 +1,506 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Synthetic trace generator
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "kma_trace.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define MAXHOTSIZES 1024
+
+/* With -w burst, the trace has this many periods, and the requests of
+ * the first quarter of each all live to its end */
+#define NUMBURSTS 8
+
+// the lifetimes of the phases vary by up to this factor either way
+#define PHASESPREAD 4.0
+
+enum SIZE_MODEL
+  {
+    SIZE_LOG,
+    SIZE_LINEAR,
+    SIZE_ZIPF
+  };
+
+enum LIFE_MODEL
+  {
+    LIFE_UNIFORM,
+    LIFE_EARLY,
+    LIFE_EXP,
+    LIFE_MIX,
+    LIFE_FIFO
+  };
+
+enum SHAPE
+  {
+    SHAPE_PLATEAU,
+    SHAPE_RAMP,
+    SHAPE_BURST
+  };
+
+// a request waiting for its free
+typedef struct
+{
+  long death;		// the request it is freed before, n at the end
+  long id;
+} pending_t;
+
+/************Global Variables*********************************************/
+
+static const char* kSizeModels[] = { "log", "linear", "zipf", NULL };
+static const char* kLifeModels[] =
+  {
+    "uniform", "early", "exp", "mix", "fifo", NULL
+  };
+static const char* kShapes[] = { "plateau", "ramp", "burst", NULL };
+
+static enum SIZE_MODEL gSizeModel = SIZE_LOG;
+static enum LIFE_MODEL gLifeModel = LIFE_EXP;
+static enum SHAPE gShape = SHAPE_PLATEAU;
+static long gRequests = 10000;
+static int gMinSize = 8;
+static int gMaxSize = 8192;
+static int gNumHot = 16;
+static double gExponent = 1.0;
+static double gLifetime = 1000;
+static double gLongShare = 0.1;
+static int gPhases = 1;
+static int gThreads = 0;
+
+static uint64_t gState;
+
+// the hot sizes of the phase, and the cumulative Zipf weights
+static int gHotSizes[MAXHOTSIZES];
+static double gHotWeights[MAXHOTSIZES];
+
+// the lifetimes of the phase are scaled by this
+static double gPhaseFactor = 1.0;
+
+static pending_t* gHeap = NULL;
+static long gHeapSize = 0;
+
+/************Function Prototypes******************************************/
+void generate(trace_writer_t*);
+void newPhase(int);
+int drawSize();
+long drawDeath(long);
+void push(long, long);
+void pop(pending_t*);
+int before(pending_t*, pending_t*);
+double uniform();
+int lookup(const char**, char*);
+void usage();
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+char *name = NULL;
+
+int
+main(int argc, char* argv[])
+{
+  enum TRACE_FORMAT format = TRACE_TEXT;
+  trace_writer_t* writer;
+  uint64_t seed = 1;
+  int opt;
+
+  name = argv[0];
+
+  while ((opt = getopt(argc, argv, "n:S:s:m:M:k:e:l:L:f:w:p:t:bz")) != -1)
+    {
+      switch (opt)
+	{
+	case 'n':
+	  gRequests = atol(optarg);
+	  break;
+	case 'S':
+	  seed = strtoull(optarg, NULL, 0);
+	  break;
+	case 's':
+	  gSizeModel = lookup(kSizeModels, optarg);
+	  break;
+	case 'm':
+	  gMinSize = atoi(optarg);
+	  break;
+	case 'M':
+	  gMaxSize = atoi(optarg);
+	  break;
+	case 'k':
+	  gNumHot = atoi(optarg);
+	  break;
+	case 'e':
+	  gExponent = atof(optarg);
+	  break;
+	case 'l':
+	  gLifeModel = lookup(kLifeModels, optarg);
+	  break;
+	case 'L':
+	  gLifetime = atof(optarg);
+	  break;
+	case 'f':
+	  gLongShare = atof(optarg);
+	  break;
+	case 'w':
+	  gShape = lookup(kShapes, optarg);
+	  break;
+	case 'p':
+	  gPhases = atoi(optarg);
+	  break;
+	case 't':
+	  gThreads = atoi(optarg);
+	  break;
+	case 'b':
+	  format = TRACE_BINARY;
+	  break;
+	case 'z':
+	  format = TRACE_COMPRESSED;
+	  break;
+	default:
+	  usage();
+	}
+    }
+
+  if (optind != argc - 1 || gRequests <= 0 || gMinSize <= 0
+      || gMaxSize < gMinSize || gNumHot <= 0 || gNumHot > MAXHOTSIZES
+      || gLifetime < 1 || gPhases <= 0 || gPhases > gRequests
+      || gThreads < 0 || gThreads >= TRACE_NO_TID)
+    {
+      usage();
+    }
+
+  gState = seed;
+  writer = trace_create(argv[optind], gRequests, format);
+  generate(writer);
+  trace_finish(writer);
+  return 0;
+}
+
+/* Every request draws its size and the request before which it is
+ * freed. The frees wait in a heap by that time and are written as the
+ * requests reach it; whatever is left is freed at the end, in order */
+void
+generate(trace_writer_t* writer)
+{
+  pending_t next;
+  trace_op_t op;
+  int* sizes;
+  unsigned short* tids;	// of the free
+  long live = 0, peak = 0;
+  long phase = -1;
+  long r;
+  int producers = gThreads;
+
+  // fifo pairs each producer with a consumer
+  if (gLifeModel == LIFE_FIFO && gThreads > 1)
+    {
+      producers = gThreads / 2;
+    }
+
+  sizes = malloc(gRequests * sizeof(int));
+  tids = malloc(gRequests * sizeof(unsigned short));
+  gHeap = malloc(gRequests * sizeof(pending_t));
+  if (sizes == NULL || tids == NULL || gHeap == NULL)
+    {
+      error("out of memory generating", "");
+    }
+
+  for (r = 0; r <= gRequests; r++)
+    {
+      while (gHeapSize > 0 && (gHeap[0].death <= r || r == gRequests))
+	{
+	  pop(&next);
+	  op.type = TRACE_FREE;
+	  op.id = next.id;
+	  op.size = 0;
+	  op.tid = (gThreads > 0) ? tids[next.id] : -1;
+	  trace_write(writer, &op);
+	  live -= sizes[next.id];
+	}
+      if (r == gRequests)
+	{
+	  break;
+	}
+
+      if (r * gPhases / gRequests != phase)
+	{
+	  phase = r * gPhases / gRequests;
+	  newPhase(phase);
+	}
+
+      op.type = TRACE_REQUEST;
+      op.id = r;
+      op.size = sizes[r] = drawSize();
+      op.tid = -1;
+      if (gThreads > 0)
+	{
+	  /* for fifo the first half of the threads allocates what the
+	   * second half frees, otherwise a thread frees its own */
+	  op.tid = uniform() * producers;
+	  tids[r] = op.tid;
+	  if (gLifeModel == LIFE_FIFO && gThreads > 1)
+	    {
+	      tids[r] = op.tid + producers;
+	    }
+	}
+      trace_write(writer, &op);
+      push(drawDeath(r), r);
+
+      live += sizes[r];
+      if (live > peak)
+	{
+	  peak = live;
+	}
+    }
+
+  printf("%ld allocations, %ld deallocations\n", gRequests, gRequests);
+  printf("Maximum bytes allocated: %ld\n", peak);
+
+  free(sizes);
+  free(tids);
+  free(gHeap);
+}
+
+/* A phase draws new hot sizes, and from the second phase on scales the
+ * lifetimes by up to PHASESPREAD either way */
+void
+newPhase(int phase)
+{
+  double logMin = log(gMinSize), logMax = log(gMaxSize + 1);
+  double sum = 0;
+  int i;
+
+  if (phase > 0)
+    {
+      gPhaseFactor = exp((2 * uniform() - 1) * log(PHASESPREAD));
+    }
+
+  if (gSizeModel != SIZE_ZIPF)
+    {
+      return;
+    }
+
+  // hot sizes log-uniform over the range, of Zipf popularity by rank
+  for (i = 0; i < gNumHot; i++)
+    {
+      gHotSizes[i] = exp(logMin + uniform() * (logMax - logMin));
+      if (gHotSizes[i] > gMaxSize)
+	{
+	  gHotSizes[i] = gMaxSize;
+	}
+      sum += 1.0 / pow(i + 1, gExponent);
+      gHotWeights[i] = sum;
+    }
+  for (i = 0; i < gNumHot; i++)
+    {
+      gHotWeights[i] /= sum;
+    }
+}
+
+int
+drawSize()
+{
+  double u = uniform();
+  int lo = 0, hi = gNumHot - 1, mid;
+  int size;
+
+  switch (gSizeModel)
+    {
+    case SIZE_LINEAR:
+      return gMinSize + u * (gMaxSize - gMinSize + 1);
+    case SIZE_ZIPF:
+      while (lo < hi)
+	{
+	  mid = (lo + hi) / 2;
+	  if (gHotWeights[mid] < u)
+	    {
+	      lo = mid + 1;
+	    }
+	  else
+	    {
+	      hi = mid;
+	    }
+	}
+      return gHotSizes[lo];
+    default:
+      size = exp(log(gMinSize) + u * (log(gMaxSize + 1) - log(gMinSize)));
+      return (size > gMaxSize) ? gMaxSize : size;
+    }
+}
+
+// the request before which request r is freed, gRequests for the end
+long
+drawDeath(long r)
+{
+  long left = gRequests - r;	// requests to the end
+  double mean = gLifetime * gPhaseFactor;
+  double life;
+  long period;
+
+  if (gShape == SHAPE_BURST)
+    {
+      period = (gRequests + NUMBURSTS - 1) / NUMBURSTS;
+      if (r % period < period / 4)
+	{
+	  return r - r % period + period;
+	}
+    }
+  else if (gShape == SHAPE_RAMP)
+    {
+      // twice the mean at the end, so the live set keeps growing
+      mean *= 2.0 * (r + 1) / gRequests;
+    }
+
+  switch (gLifeModel)
+    {
+    case LIFE_UNIFORM:
+      life = 1 + uniform() * left;
+      break;
+    case LIFE_EARLY:
+      // like generate_trace: 90% in the first tenth of the rest
+      life = 1 + uniform() * ((uniform() < 0.9) ? 0.1 * left : left);
+      break;
+    case LIFE_MIX:
+      if (uniform() < gLongShare)
+	{
+	  return gRequests;
+	}
+      life = 1 - mean * log(1 - uniform());
+      break;
+    case LIFE_FIFO:
+      // a queue of constant length frees in the order of allocation
+      life = gLifetime;
+      break;
+    default:
+      life = 1 - mean * log(1 - uniform());
+    }
+
+  return (life >= left) ? gRequests : r + (long) life;
+}
+
+// the heap of pending frees, earliest first
+void
+push(long death, long id)
+{
+  long i = gHeapSize++;
+  pending_t item = { death, id };
+
+  while (i > 0 && before(&item, &gHeap[(i - 1) / 2]))
+    {
+      gHeap[i] = gHeap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+  gHeap[i] = item;
+}
+
+void
+pop(pending_t* top)
+{
+  pending_t last = gHeap[--gHeapSize];
+  long i = 0, child;
+
+  *top = gHeap[0];
+  while ((child = 2 * i + 1) < gHeapSize)
+    {
+      if (child + 1 < gHeapSize && before(&gHeap[child + 1], &gHeap[child]))
+	{
+	  child++;
+	}
+      if (!before(&gHeap[child], &last))
+	{
+	  break;
+	}
+      gHeap[i] = gHeap[child];
+      i = child;
+    }
+  gHeap[i] = last;
+}
+
+// ties go by id, so that the order does not depend on the heap
+int
+before(pending_t* a, pending_t* b)
+{
+  return a->death < b->death || (a->death == b->death && a->id < b->id);
+}
+
+// a splitmix64 step, in [0, 1)
+double
+uniform()
+{
+  uint64_t z = (gState += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int
+lookup(const char** names, char* value)
+{
+  int i;
+
+  for (i = 0; names[i] != NULL; i++)
+    {
+      if (strcmp(names[i], value) == 0)
+	{
+	  return i;
+	}
+    }
+  usage();
+  return -1;
+}
+
+void
+usage()
+{
+  printf("Usage: %s [options] [-b | -z] outputTrace\n", name);
+  printf("Writes a synthetic trace, binary with -b, compressed with -z\n");
+  printf("  -n requests         number of requests (10000)\n");
+  printf("  -S seed             the same seed gives the same trace (1)\n");
+  printf("  -s log|linear|zipf  size distribution (log)\n");
+  printf("  -m min -M max       request sizes (8, 8192)\n");
+  printf("  -k hot -e exponent  zipf: hot sizes and their Zipf exponent "
+	 "(16, 1.0)\n");
+  printf("  -l uniform|early|exp|mix|fifo\n");
+  printf("                      lifetimes: uniform or early over the rest,\n");
+  printf("                      exponential, exponential with a share "
+	 "living to the\n");
+  printf("                      end, or a queue of producers and "
+	 "consumers (exp)\n");
+  printf("  -L requests         mean lifetime, queue length for fifo "
+	 "(1000)\n");
+  printf("  -f share            mix: share living to the end (0.1)\n");
+  printf("  -w plateau|ramp|burst\n");
+  printf("                      shape of the live set (plateau)\n");
+  printf("  -p phases           phases with new hot sizes and lifetimes "
+	 "(1)\n");
+  printf("  -t threads          thread ids, half of them consumers for "
+	 "fifo (none)\n");
+  exit(0);
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
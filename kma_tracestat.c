@@ -0,0 +1,648 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Statistics of a trace, and the allocator they call for
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "kma_page.h"
+#include "kma_class.h"
+#include "kma_trace.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+// power-of-two buckets of sizes and lifetimes
+#define NUMBUCKETS 40
+
+// default number of phase windows over the trace
+#define NUMWINDOWS 20
+
+/* A window is a ramp or a drain if the live bytes change by more than
+ * this share of their peak over it, a plateau otherwise */
+#define PHASESHARE 0.05
+
+/* Recommendation thresholds: a table has to save this share of the
+ * pages to be worth it, front ends need this share of requests to fit
+ * their classes, and magazines pay off from this share of frees by
+ * another thread than the allocating one */
+#define SAVINGSHARE 0.05
+#define CACHESHARE 0.5
+#define CROSSSHARE 0.25
+
+#define NUMTABLES 3
+#define NUMTHREADS 0x10000
+
+enum PHASE
+  {
+    PLATEAU,
+    RAMP,
+    DRAIN
+  };
+
+// a size-class table of a backend or front end
+typedef struct
+{
+  char* name;
+  const int* sizes;	// ascending
+  int numSizes;
+  long fit;		// requests up to the largest size
+  double requested;	// bytes of those
+  double rounded;	// and what they were rounded to
+  long live;		// rounded bytes, with page runs above the table
+  long peak;
+} table_t;
+
+// what is live of an id
+typedef struct
+{
+  long start;		// -1 if not live
+  int size;
+  int tid;
+} live_t;
+
+typedef struct
+{
+  long first;		// op
+  long last;
+  enum PHASE kind;
+  long requests;
+  double bytes;
+  long liveStart;
+  long liveEnd;
+} phase_t;
+
+/************Global Variables*********************************************/
+
+static const char* kPhaseNames[] =
+  {
+    "plateau", "ramp", "drain"
+  };
+
+// KMA_BUD: powers of two up to a page
+static const int kBudSizes[] =
+  {
+    32, 64, 128, 256, 512, 1024, 2048, 4096, 8192
+  };
+
+// KMA_WBUD: 2^k and 3*2^k up to a page, see kma_wbud.c
+static const int kWbudSizes[] =
+  {
+      32,   64,   96,  128,  192,  256,  384,  512,
+     768, 1024, 1536, 2048, 3072, 4096, 6144, 8192
+  };
+
+// KMA_TCACHE and KMA_MAGAZINE: kma_class.c, filled in by main
+static int gClassSizes[NUMSIZECLASSES];
+
+static table_t gTables[NUMTABLES] =
+  {
+    { "KMA_BUD", kBudSizes, sizeof(kBudSizes) / sizeof(int) },
+    { "KMA_WBUD", kWbudSizes, sizeof(kWbudSizes) / sizeof(int) },
+    { "classes", gClassSizes, NUMSIZECLASSES }
+  };
+
+static long gSizes[NUMBUCKETS];
+static double gSizeBytes[NUMBUCKETS];
+static long gLifetimes[NUMBUCKETS];
+
+static long gOps = 0;
+static long gRequests = 0;
+static long gFrees = 0;
+static long gCross = 0;	// frees by another thread
+static double gBytes = 0;
+static int gMinSize = -1;
+static int gMaxSize = 0;
+static long gThreads = 0;
+
+static long gLive = 0;
+static long gPeakLive = 0;
+static long gPeakOp = 0;
+static long gLiveBlocks = 0;
+static long gPeakBlocks = 0;
+
+// lifetimes of the freed requests, in ops
+static long* gSpans = NULL;
+static long gNumSpans = 0;
+static long gMaxSpans = 0;
+
+static phase_t* gPhases = NULL;
+static long gNumPhases = 0;
+
+/************Function Prototypes******************************************/
+void scan(char*, long);
+void request(live_t*, trace_op_t*);
+void release(live_t*, trace_op_t*);
+void endWindow(phase_t*, long);
+long rounded(table_t*, int);
+int bucket(long);
+void printSizes();
+void printLifetimes();
+void printPhases();
+void printTables();
+void recommend();
+int compareLongs(const void*, const void*);
+void usage();
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+char *name = NULL;
+
+int
+main(int argc, char* argv[])
+{
+  long window = 0;
+  int opt;
+  int i;
+
+  name = argv[0];
+
+  while ((opt = getopt(argc, argv, "w:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'w':
+	  window = atol(optarg);
+	  if (window <= 0)
+	    {
+	      usage();
+	    }
+	  break;
+	default:
+	  usage();
+	}
+    }
+
+  if (optind != argc - 1)
+    {
+      usage();
+    }
+
+  for (i = 0; i < NUMSIZECLASSES; i++)
+    {
+      gClassSizes[i] = class_size(i);
+    }
+
+  scan(argv[optind], window);
+
+  printf("Trace: %ld ops, %ld requests, %ld frees, %ld never freed, "
+	 "%ld thread%s\n", gOps, gRequests, gFrees, gRequests - gFrees,
+	 gThreads, (gThreads == 1) ? "" : "s");
+  printf("Peak live: %ld bytes (%ld pages) in %ld blocks, after op %ld\n",
+	 gPeakLive, (gPeakLive + PAGESIZE - 1) / PAGESIZE, gPeakBlocks,
+	 gPeakOp);
+  if (gRequests == 0)
+    {
+      return 0;
+    }
+
+  printSizes();
+  printLifetimes();
+  printPhases();
+  printTables();
+  recommend();
+  return 0;
+}
+
+/* Replays the trace once, keeping per id what is live, and the live
+ * bytes of every window of ops for the phases */
+void
+scan(char* path, long window)
+{
+  trace_t* trace = trace_open(path);
+  trace_op_t op;
+  live_t* live;
+  char* seen;		// threads
+  long numIds = trace_ids(trace);
+  long maxPhases = 64;
+  phase_t current;
+
+  live = malloc(numIds * sizeof(live_t) + sizeof(live_t));
+  seen = calloc(NUMTHREADS, 1);
+  gPhases = malloc(maxPhases * sizeof(phase_t));
+  if (live == NULL || seen == NULL || gPhases == NULL)
+    {
+      error("out of memory reading", path);
+    }
+  memset(live, -1, numIds * sizeof(live_t));
+
+  if (window == 0)
+    {
+      // the text header has no op count, so guess from the ids
+      window = (2 * numIds + NUMWINDOWS - 1) / NUMWINDOWS;
+      if (window < 100)
+	{
+	  window = 100;
+	}
+    }
+
+  memset(&current, 0, sizeof(current));
+  while (trace_next(trace, &op))
+    {
+      if (op.id < 0 || op.id >= numIds)
+	{
+	  error("request id out of range", path);
+	}
+      if (op.tid >= 0 && op.tid < NUMTHREADS && !seen[op.tid])
+	{
+	  seen[op.tid] = 1;
+	  gThreads++;
+	}
+
+      if (op.type == TRACE_REQUEST)
+	{
+	  if (live[op.id].start >= 0)
+	    {
+	      error("REQUEST of a request that is allocated", path);
+	    }
+	  request(&live[op.id], &op);
+	  current.requests++;
+	  current.bytes += op.size;
+	}
+      else
+	{
+	  if (live[op.id].start < 0)
+	    {
+	      error("FREE of a request that is not allocated", path);
+	    }
+	  release(&live[op.id], &op);
+	}
+      gOps++;
+
+      if (gOps % window == 0)
+	{
+	  if (gNumPhases == maxPhases)
+	    {
+	      maxPhases *= 2;
+	      gPhases = realloc(gPhases, maxPhases * sizeof(phase_t));
+	      if (gPhases == NULL)
+		{
+		  error("out of memory reading", path);
+		}
+	    }
+	  endWindow(&current, window);
+	}
+    }
+  if (gOps % window != 0)
+    {
+      endWindow(&current, gOps % window);
+    }
+
+  if (gThreads == 0)
+    {
+      gThreads = 1;
+    }
+
+  free(live);
+  free(seen);
+  trace_close(trace);
+}
+
+void
+request(live_t* block, trace_op_t* op)
+{
+  int i;
+
+  block->start = gOps;
+  block->size = op->size;
+  block->tid = op->tid;
+
+  gRequests++;
+  gBytes += op->size;
+  if (gMinSize < 0 || op->size < gMinSize)
+    {
+      gMinSize = op->size;
+    }
+  if (op->size > gMaxSize)
+    {
+      gMaxSize = op->size;
+    }
+  gSizes[bucket(op->size)]++;
+  gSizeBytes[bucket(op->size)] += op->size;
+
+  gLive += op->size;
+  gLiveBlocks++;
+  if (gLive > gPeakLive)
+    {
+      gPeakLive = gLive;
+      gPeakOp = gOps + 1;
+    }
+  if (gLiveBlocks > gPeakBlocks)
+    {
+      gPeakBlocks = gLiveBlocks;
+    }
+
+  for (i = 0; i < NUMTABLES; i++)
+    {
+      if (op->size <= gTables[i].sizes[gTables[i].numSizes - 1])
+	{
+	  gTables[i].fit++;
+	  gTables[i].requested += op->size;
+	  gTables[i].rounded += rounded(&gTables[i], op->size);
+	}
+      gTables[i].live += rounded(&gTables[i], op->size);
+      if (gTables[i].live > gTables[i].peak)
+	{
+	  gTables[i].peak = gTables[i].live;
+	}
+    }
+}
+
+void
+release(live_t* block, trace_op_t* op)
+{
+  int i;
+
+  if (gNumSpans == gMaxSpans)
+    {
+      gMaxSpans = (gMaxSpans > 0) ? 2 * gMaxSpans : 1024;
+      gSpans = realloc(gSpans, gMaxSpans * sizeof(long));
+      if (gSpans == NULL)
+	{
+	  error("out of memory reading", "");
+	}
+    }
+  gSpans[gNumSpans++] = gOps - block->start;
+  gLifetimes[bucket(gOps - block->start)]++;
+
+  gFrees++;
+  if (op->tid != block->tid)
+    {
+      gCross++;
+    }
+  gLive -= block->size;
+  gLiveBlocks--;
+  for (i = 0; i < NUMTABLES; i++)
+    {
+      gTables[i].live -= rounded(&gTables[i], block->size);
+    }
+  block->start = -1;
+}
+
+// closes the window that ends at the current op
+void
+endWindow(phase_t* current, long ops)
+{
+  phase_t* last = (gNumPhases > 0) ? &gPhases[gNumPhases - 1] : NULL;
+  long change = gLive - current->liveStart;
+
+  current->first = gOps - ops;
+  current->last = gOps;
+  current->liveEnd = gLive;
+  current->kind = PLATEAU;
+  if (change > PHASESHARE * gPeakLive)
+    {
+      current->kind = RAMP;
+    }
+  else if (-change > PHASESHARE * gPeakLive)
+    {
+      current->kind = DRAIN;
+    }
+
+  // windows of one kind in a row are one phase
+  if (last != NULL && last->kind == current->kind)
+    {
+      last->last = current->last;
+      last->requests += current->requests;
+      last->bytes += current->bytes;
+      last->liveEnd = current->liveEnd;
+    }
+  else
+    {
+      gPhases[gNumPhases++] = *current;
+    }
+
+  memset(current, 0, sizeof(phase_t));
+  current->liveStart = gLive;
+}
+
+/* The block a request gets from a table. Larger requests get a
+ * power-of-two run of whole pages, as from get_pages() */
+long
+rounded(table_t* table, int size)
+{
+  long run = PAGESIZE;
+  int lo = 0, hi = table->numSizes, mid;
+
+  if (size > table->sizes[table->numSizes - 1])
+    {
+      while (run < size)
+	{
+	  run *= 2;
+	}
+      return run;
+    }
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (table->sizes[mid] < size)
+	{
+	  lo = mid + 1;
+	}
+      else
+	{
+	  hi = mid;
+	}
+    }
+  return table->sizes[lo];
+}
+
+// 0 for 0 and 1, else k for 2^(k-1) < n <= 2^k
+int
+bucket(long n)
+{
+  int k = 0;
+
+  while (k < NUMBUCKETS - 1 && (1L << k) < n)
+    {
+      k++;
+    }
+  return k;
+}
+
+void
+printSizes()
+{
+  int k;
+
+  printf("\nSizes: %d to %d bytes, mean %.0f\n", gMinSize, gMaxSize,
+	 gBytes / gRequests);
+  printf("  %-16s %10s %8s %8s\n", "bytes", "requests", "%reqs", "%bytes");
+  for (k = 0; k < NUMBUCKETS; k++)
+    {
+      if (gSizes[k] == 0)
+	{
+	  continue;
+	}
+      printf("  %7ld - %-6ld %10ld %7.2f%% %7.2f%%\n",
+	     (k == 0) ? 0 : (1L << (k - 1)) + 1, 1L << k, gSizes[k],
+	     100.0 * gSizes[k] / gRequests, 100.0 * gSizeBytes[k] / gBytes);
+    }
+}
+
+void
+printLifetimes()
+{
+  int k;
+
+  if (gNumSpans == 0)
+    {
+      printf("\nLifetimes: nothing is freed\n");
+      return;
+    }
+
+  qsort(gSpans, gNumSpans, sizeof(long), compareLongs);
+  printf("\nLifetimes of the freed requests, in ops: p50 %ld, p90 %ld, "
+	 "p99 %ld, max %ld\n", gSpans[gNumSpans / 2],
+	 gSpans[gNumSpans * 9 / 10], gSpans[gNumSpans * 99 / 100],
+	 gSpans[gNumSpans - 1]);
+  printf("  %-16s %10s %8s\n", "ops", "frees", "%frees");
+  for (k = 0; k < NUMBUCKETS; k++)
+    {
+      if (gLifetimes[k] == 0)
+	{
+	  continue;
+	}
+      printf("  %7ld - %-6ld %10ld %7.2f%%\n",
+	     (k == 0) ? 1 : (1L << (k - 1)) + 1, 1L << k, gLifetimes[k],
+	     100.0 * gLifetimes[k] / gNumSpans);
+    }
+}
+
+void
+printPhases()
+{
+  phase_t* phase;
+  long i;
+
+  printf("\nPhases (live bytes changing by more than %.0f%% of the peak "
+	 "per window):\n", 100 * PHASESHARE);
+  printf("  %-20s %-8s %8s %9s %12s %12s\n", "ops", "kind", "%reqs",
+	 "mean size", "live from", "live to");
+  for (i = 0; i < gNumPhases; i++)
+    {
+      phase = &gPhases[i];
+      printf("  %9ld - %-8ld %-8s %7.2f%% %9.0f %12ld %12ld\n",
+	     phase->first, phase->last, kPhaseNames[phase->kind],
+	     100.0 * phase->requests / (phase->last - phase->first),
+	     (phase->requests > 0) ? phase->bytes / phase->requests : 0.0,
+	     phase->liveStart, phase->liveEnd);
+    }
+}
+
+void
+printTables()
+{
+  table_t* table;
+  int i;
+
+  printf("\nSize classes (requests up to the largest class, what they "
+	 "are rounded by, and\nthe peak of the rounded live bytes with "
+	 "page runs for larger requests):\n");
+  printf("  %-10s %8s %8s %10s %14s %8s\n", "table", "largest", "%fit",
+	 "%rounding", "peak bytes", "pages");
+  for (i = 0; i < NUMTABLES; i++)
+    {
+      table = &gTables[i];
+      printf("  %-10s %8d %7.2f%% %9.2f%% %14ld %8ld\n", table->name,
+	     table->sizes[table->numSizes - 1],
+	     100.0 * table->fit / gRequests,
+	     (table->requested > 0)
+	     ? 100.0 * (table->rounded / table->requested - 1) : 0.0,
+	     table->peak, (table->peak + PAGESIZE - 1) / PAGESIZE);
+    }
+}
+
+/* Picks the buddy system whose table needs fewer pages at the peak,
+ * KMA_BUD unless KMA_WBUD saves enough, and for traces of several
+ * threads a front end over it if enough requests fit its classes */
+void
+recommend()
+{
+  char* backend = "KMA_BUD";
+  table_t* classes = &gTables[2];
+  double saving;
+  double fit = (double) classes->fit / gRequests;
+  double cross = (gFrees > 0) ? (double) gCross / gFrees : 0.0;
+
+  saving = 1.0 - (double) gTables[1].peak / gTables[0].peak;
+  printf("\nRecommendation: ");
+  if (saving > SAVINGSHARE)
+    {
+      backend = "KMA_WBUD";
+    }
+
+  if (gThreads > 1 && fit >= CACHESHARE)
+    {
+      printf("kma_%s MT_BACKEND=%s\n", (cross >= CROSSSHARE)
+	     ? "magazine" : "tcache", backend);
+    }
+  else
+    {
+      printf("kma_%s\n", (saving > SAVINGSHARE) ? "wbud" : "bud");
+    }
+
+  printf("  %s: KMA_WBUD's classes need %.1f%% %s pages than KMA_BUD's "
+	 "at the peak (%.0f%% needed)\n", backend, 100 * fabs(saving),
+	 (saving >= 0) ? "fewer" : "more", 100 * SAVINGSHARE);
+  if (gThreads == 1)
+    {
+      printf("  one thread: the backends need no front end\n");
+      return;
+    }
+  printf("  %ld threads, %.1f%% of the requests fit the front end classes "
+	 "(%.0f%% needed)\n", gThreads, 100 * fit, 100 * CACHESHARE);
+  if (fit >= CACHESHARE)
+    {
+      printf("  %.1f%% of the frees are by another thread than the "
+	     "allocating one: %s (%.0f%% or more for magazines)\n",
+	     100 * cross, (cross >= CROSSSHARE)
+	     ? "magazines move them through the depot"
+	     : "thread caches keep less memory cached",
+	     100 * CROSSSHARE);
+    }
+}
+
+int
+compareLongs(const void* a, const void* b)
+{
+  long x = *(long*) a;
+  long y = *(long*) b;
+
+  return (x > y) - (x < y);
+}
+
+void
+usage()
+{
+  printf("Usage: %s [-w ops] traceFile\n", name);
+  printf("Prints the size histogram, lifetimes, live bytes and phases of\n");
+  printf("a trace, how it fits the size classes of the backends, and the\n");
+  printf("allocator it calls for\n");
+  printf("  -w  ops per phase window (default: about a %dth of the "
+	 "trace)\n", NUMWINDOWS);
+  exit(0);
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
@@ -0,0 +1,468 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Kernel memory allocator based on the weighted buddy
+ *             algorithm
+ ***************************************************************************/
+#ifdef KMA_WBUD
+#define __KMA_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_instr.h"
+#include "kma_stats.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* Block sizes are 2^k and 3*2^k. A 2^k block splits into 3*2^(k-2)
+ * (left) and 2^(k-2) (right), a 3*2^k block into 2^(k+1) (left) and
+ * 2^k (right). The left child is always the next smaller class, so
+ * any class can be reached from any larger one. When exactly half of
+ * a 2^k block is wanted it is split into two halves instead, so that
+ * e.g. a page still holds two 4096-byte blocks. Every 2^k block is
+ * aligned to 2^k within its page. */
+#define MINBLOCKSIZE 32
+#define GRANULES (PAGESIZE / MINBLOCKSIZE)
+#define NUMCLASSES 16
+#define ROOTCLASS (NUMCLASSES - 1)
+
+/* per-granule state, valid at the first granule of every block */
+#define FREEFLAG 0x80
+#define CLASSMASK 0x0f
+#define BINARYSPLIT 0x10
+#define LINKMASK (CLASSMASK | BINARYSPLIT)
+#define STASHSHIFT 8
+
+/* The free blocks of a class are found through two bitmaps: one bit
+ * per page that has a free block of the class, and per page one bit
+ * per free block head. One summary bit per word of pages keeps the
+ * search for the lowest such page short on large pools. */
+#define WORDBITS 64
+#define HEADWORDS (GRANULES / WORDBITS)
+#define PAGEWORDS ((MAXPAGES + WORDBITS - 1) / WORDBITS)
+#define SUMMARYWORDS ((PAGEWORDS + WORDBITS - 1) / WORDBITS)
+
+/* Out-of-band metadata of a page. For each block head, cls holds the
+ * class and the free flag, and link holds the class of the parent and
+ * how it was split. A right child also stashes the parent's own link
+ * in the high byte, so it can be restored on merge. free has the free
+ * block heads of each class. */
+typedef struct
+{
+  kma_page_t* page;
+  unsigned char cls[GRANULES];
+  unsigned short link[GRANULES];
+  uint64_t free[NUMCLASSES][HEADWORDS];
+} wbud_page_t;
+
+/************Global Variables*********************************************/
+
+static const int kClassSize[NUMCLASSES] =
+  {
+      32,   64,   96,  128,  192,  256,  384,  512,
+     768, 1024, 1536, 2048, 3072, 4096, 6144, 8192
+  };
+
+// class of the right child of each class, the left one is always cls-1
+static const int kRightClass[NUMCLASSES] =
+  {
+      -1,   -1,    0,    0,    1,    1,    3,    3,
+       5,    5,    7,    7,    9,    9,   11,   11
+  };
+
+// pages with a free block of each class, and the words of those
+static uint64_t gFreePages[NUMCLASSES][PAGEWORDS];
+static uint64_t gFreeSummary[NUMCLASSES][SUMMARYWORDS];
+static int gNumFreePages[NUMCLASSES];
+
+static wbud_page_t* gPageMeta = NULL;	// page_table(), MAXPAGES entries
+
+static kma_stats_t gStats;
+
+/************Function Prototypes******************************************/
+static int sizeToClass(kma_size_t);
+static void pushFree(void*, int);
+static void removeFree(void*, int);
+static void* firstFree(int);
+static int hasFree(wbud_page_t*, int);
+static wbud_page_t* addPage(kma_page_t*);
+static void* allocBlock(int);
+static void freeBlock(void*);
+static void walkPage(void*, int, void*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void*
+kma_malloc(kma_size_t size)
+{
+  kma_page_t* page;
+  void* block;
+
+  INSTR_START(start);
+  stats_request(&gStats, size);
+
+  if (size > PAGESIZE)
+    {
+      // large objects get a power-of-two run of whole pages
+      page = get_pages((size + PAGESIZE - 1) / PAGESIZE);
+      addPage(page);
+      gStats.bytes_used += page->size;
+      INSTR_END(KMA_EV_MALLOC, start);
+      return page->ptr;
+    }
+
+  block = allocBlock(sizeToClass(size));
+  INSTR_END(KMA_EV_MALLOC, start);
+  return block;
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+  wbud_page_t* meta;
+
+  INSTR_START(start);
+  stats_release(&gStats, size);
+
+  if (size > PAGESIZE)
+    {
+      meta = &gPageMeta[page_index(ptr)];
+      gStats.bytes_used -= meta->page->size;
+      free_page(meta->page);
+      meta->page = NULL;
+      INSTR_END(KMA_EV_FREE, start);
+      return;
+    }
+
+  freeBlock(ptr);
+  INSTR_END(KMA_EV_FREE, start);
+}
+
+kma_stats_t*
+kma_stats()
+{
+  // the free lists and the block states are kept out of the pages
+  return stats_snapshot(&gStats, sizeof(gFreePages) + sizeof(gFreeSummary)
+			+ MAXPAGES * sizeof(wbud_page_t), 0);
+}
+
+void
+kma_heap_walk(kma_walk_fn fn, void* arg)
+{
+  kma_walk_t walk = { fn, arg };
+
+  // without pages of our own there is no page table yet
+  if (gPageMeta == NULL)
+    {
+      return;
+    }
+  page_walk(walkPage, &walk);
+}
+
+static int
+sizeToClass(kma_size_t size)
+{
+  int cls;
+
+  for (cls = 0; kClassSize[cls] < size; cls++)
+    ;
+
+  return cls;
+}
+
+/* The lowest free block is always taken (firstFree()), which packs
+ * allocations into the low pages and lets the upper ones drain and get
+ * released. No link is kept in the blocks themselves. */
+static void
+pushFree(void* ptr, int cls)
+{
+  int page = page_index(ptr);
+  wbud_page_t* meta = &gPageMeta[page];
+  int head = (ptr - BASEADDR(ptr)) / MINBLOCKSIZE;
+
+  if (!hasFree(meta, cls))
+    {
+      gFreePages[cls][page / WORDBITS] |= 1ULL << (page % WORDBITS);
+      gFreeSummary[cls][page / WORDBITS / WORDBITS]
+	|= 1ULL << (page / WORDBITS % WORDBITS);
+      gNumFreePages[cls]++;
+    }
+
+  meta->free[cls][head / WORDBITS] |= 1ULL << (head % WORDBITS);
+  meta->cls[head] = cls | FREEFLAG;
+}
+
+static void
+removeFree(void* ptr, int cls)
+{
+  int page = page_index(ptr);
+  wbud_page_t* meta = &gPageMeta[page];
+  int head = (ptr - BASEADDR(ptr)) / MINBLOCKSIZE;
+
+  meta->free[cls][head / WORDBITS] &= ~(1ULL << (head % WORDBITS));
+  meta->cls[head] = cls;
+
+  if (!hasFree(meta, cls))
+    {
+      gFreePages[cls][page / WORDBITS] &= ~(1ULL << (page % WORDBITS));
+      if (gFreePages[cls][page / WORDBITS] == 0)
+	{
+	  gFreeSummary[cls][page / WORDBITS / WORDBITS]
+	    &= ~(1ULL << (page / WORDBITS % WORDBITS));
+	}
+      gNumFreePages[cls]--;
+    }
+}
+
+// the free block of a class at the lowest address
+static void*
+firstFree(int cls)
+{
+  wbud_page_t* meta;
+  int word, page, head;
+
+  assert(gNumFreePages[cls] > 0);
+
+  for (word = 0; gFreeSummary[cls][word] == 0; word++)
+    ;
+  word = word * WORDBITS + __builtin_ctzll(gFreeSummary[cls][word]);
+  page = word * WORDBITS + __builtin_ctzll(gFreePages[cls][word]);
+
+  meta = &gPageMeta[page];
+  for (word = 0; meta->free[cls][word] == 0; word++)
+    ;
+  head = word * WORDBITS + __builtin_ctzll(meta->free[cls][word]);
+
+  return meta->page->ptr + head * MINBLOCKSIZE;
+}
+
+static int
+hasFree(wbud_page_t* meta, int cls)
+{
+  int word;
+
+  for (word = 0; word < HEADWORDS; word++)
+    {
+      if (meta->free[cls][word] != 0)
+	{
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+static void*
+allocBlock(int want)
+{
+  kma_page_t* page;
+  wbud_page_t* meta;
+  void* block;
+  int cls, lcls, rcls, head, rhead, split;
+
+  // smallest class with a free block that is large enough
+  for (cls = want; cls < NUMCLASSES; cls++)
+    {
+      if (gNumFreePages[cls] > 0)
+	{
+	  break;
+	}
+    }
+
+  if (cls == NUMCLASSES)
+    {
+      page = get_page();
+      meta = addPage(page);
+      block = page->ptr;
+      cls = ROOTCLASS;
+      meta->cls[0] = cls;
+    }
+  else
+    {
+      block = firstFree(cls);
+      removeFree(block, cls);
+      meta = &gPageMeta[page_index(block)];
+    }
+
+  head = (block - BASEADDR(block)) / MINBLOCKSIZE;
+
+  // split until the block has the wanted class or cannot be split
+  while (cls != want)
+    {
+      if (kClassSize[want] * 2 == kClassSize[cls]
+	  && (kClassSize[cls] & (kClassSize[cls] - 1)) == 0)
+	{
+	  split = BINARYSPLIT;
+	  lcls = want;
+	  rcls = want;
+	}
+      else if (kClassSize[cls] > 64)
+	{
+	  split = 0;
+	  lcls = cls - 1;
+	  rcls = kRightClass[cls];
+	}
+      else
+	{
+	  break;
+	}
+
+      gStats.n_split++;
+      INSTR_EVENT(KMA_EV_SPLIT);
+
+      // the right child keeps our own link for the merge
+      rhead = head + kClassSize[lcls] / MINBLOCKSIZE;
+      meta->link[rhead] = ((meta->link[head] & LINKMASK) << STASHSHIFT)
+	| split | cls;
+      meta->link[head] = (meta->link[head] & ~LINKMASK) | split | cls;
+
+      if (kClassSize[rcls] >= kClassSize[want])
+	{
+	  // the right child still fits, keep it
+	  pushFree(block, lcls);
+	  block = block + kClassSize[lcls];
+	  head = rhead;
+	  cls = rcls;
+	}
+      else
+	{
+	  pushFree(block + kClassSize[lcls], rcls);
+	  cls = lcls;
+	}
+    }
+
+  meta->cls[head] = cls;
+  gStats.bytes_used += kClassSize[cls];
+  return block;
+}
+
+static void
+freeBlock(void* ptr)
+{
+  wbud_page_t* meta = &gPageMeta[page_index(ptr)];
+  void* page = BASEADDR(ptr);
+  void* buddy;
+  int head, bhead, cls, bcls, lcls, parent, binary, left;
+
+  head = (ptr - page) / MINBLOCKSIZE;
+  cls = meta->cls[head];
+  assert((cls & FREEFLAG) == 0);
+  gStats.bytes_used -= kClassSize[cls];
+
+  // merge with the buddy for as long as it is free and whole
+  while (cls != ROOTCLASS)
+    {
+      parent = meta->link[head] & CLASSMASK;
+      binary = meta->link[head] & BINARYSPLIT;
+      if (binary)
+	{
+	  lcls = cls;
+	  left = ((ptr - page) & kClassSize[cls]) == 0;
+	}
+      else
+	{
+	  lcls = parent - 1;
+	  left = (cls == lcls);
+	}
+
+      if (left)
+	{
+	  buddy = ptr + kClassSize[cls];
+	  bcls = binary ? cls : kRightClass[parent];
+	}
+      else
+	{
+	  buddy = ptr - kClassSize[lcls];
+	  bcls = lcls;
+	}
+
+      bhead = (buddy - page) / MINBLOCKSIZE;
+      if (meta->cls[bhead] != (bcls | FREEFLAG))
+	{
+	  break;
+	}
+      removeFree(buddy, bcls);
+      gStats.n_coalesce++;
+      INSTR_EVENT(KMA_EV_COALESCE);
+
+      if (!left)
+	{
+	  ptr = buddy;
+	  head = bhead;
+	}
+
+      // restore the parent's own link from the right child
+      meta->link[head] = (meta->link[head] & ~LINKMASK)
+	| (meta->link[head + kClassSize[lcls] / MINBLOCKSIZE] >> STASHSHIFT);
+      cls = parent;
+    }
+
+  if (cls == ROOTCLASS)
+    {
+      free_page(meta->page);
+      meta->page = NULL;
+      return;
+    }
+
+  pushFree(ptr, cls);
+}
+
+// the page table entry of a page we just got
+static wbud_page_t*
+addPage(kma_page_t* page)
+{
+  wbud_page_t* meta;
+
+  if (gPageMeta == NULL)
+    {
+      gPageMeta = page_table(sizeof(wbud_page_t));
+    }
+  meta = &gPageMeta[page_index(page->ptr)];
+  meta->page = page;
+  return meta;
+}
+
+static void
+walkPage(void* ptr, int count, void* arg)
+{
+  kma_walk_t* walk = (kma_walk_t*) arg;
+  wbud_page_t* meta = &gPageMeta[page_index(ptr)];
+  int head, cls;
+
+  // pages of a front end are not ours
+  if (meta->page == NULL || meta->page->ptr != ptr)
+    {
+      return;
+    }
+  if (meta->page->size > PAGESIZE)
+    {
+      stats_region(walk->fn, walk->arg, ptr, meta->page->size,
+		   KMA_REGION_USED);
+      return;
+    }
+
+  // the blocks tile the page, each head knows its class
+  for (head = 0; head < GRANULES;
+       head += kClassSize[cls & CLASSMASK] / MINBLOCKSIZE)
+    {
+      cls = meta->cls[head];
+      stats_region(walk->fn, walk->arg, ptr + head * MINBLOCKSIZE,
+		   kClassSize[cls & CLASSMASK],
+		   (cls & FREEFLAG) ? KMA_REGION_FREE : KMA_REGION_USED);
+    }
+}
+
+#endif // KMA_WBUD
@@ -0,0 +1,173 @@
+#!/bin/bash
+#
+# Performance regression check: compares a benchmark matrix (bench.sh
+# CSV, several reps per backend and trace) against a baseline in the
+# same format, see "make perf-check". For every backend, trace and
+# metric it prints the baseline and current medians, the change and
+# the p-value of a one-sided Mann-Whitney U test that the current runs
+# are worse. A metric regresses when it got worse by more than the
+# threshold AND the test rejects noise at the given level, so one slow
+# run does not fail the check and neither does a tiny but consistent
+# change. A backend that ran in the baseline and fails now regresses
+# as well. Backends or traces missing from either file are skipped.
+# Exits with 1 if anything regressed. The defaults are those of
+# "make perf-check".
+#
+
+# metric:direction, + if larger is better
+METRICS="ops_per_sec:+ p99_ns:- malloc_p99_ns:- free_p99_ns:- waste_ratio:-";
+
+THRESHOLD=25;
+ALPHA=0.05;
+
+function usage()
+{
+	echo "usage: $0 [-t percent] [-p alpha] baseline.csv current.csv";
+	exit 1;
+}
+
+while getopts "t:p:" opt; do
+	case ${opt} in
+	t) THRESHOLD=${OPTARG};;
+	p) ALPHA=${OPTARG};;
+	*) usage;;
+	esac;
+done;
+shift $((OPTIND - 1));
+
+if [[ $# -ne 2 || ! -r $1 || ! -r $2 ]]; then
+	usage;
+fi;
+
+awk -F, -v metrics="${METRICS}" -v threshold=${THRESHOLD} -v alpha=${ALPHA} '
+# number of arrangements of m baseline and n current runs with each
+# value of U, by the recurrence on whether the largest value is a
+# current run (it beats all m baseline runs) or a baseline run
+function distribution(m, n,    i, j, u)
+{
+	if ((m, n) in done)
+		return;
+	for (i = 0; i <= m; i++)
+		for (j = 0; j <= n; j++)
+			for (u = 0; u <= i * j; u++) {
+				if (i == 0 || j == 0)
+					f[i, j, u] = (u == 0);
+				else
+					f[i, j, u] = f[i - 1, j, u] + \
+						(u >= i ? f[i, j - 1, u - i] : 0);
+			}
+	done[m, n] = 1;
+}
+
+# P(U >= u) for n current runs against m baseline runs
+function pvalue(m, n, u,    k, total, tail)
+{
+	distribution(m, n);
+	total = 0;
+	tail = 0;
+	for (k = 0; k <= m * n; k++) {
+		total += f[m, n, k];
+		if (k >= u)
+			tail += f[m, n, k];
+	}
+	return tail / total;
+}
+
+function median(list,    v, n, i, j, t)
+{
+	n = split(list, v, " ");
+	for (i = 2; i <= n; i++)
+		for (j = i; j > 1 && v[j - 1] > v[j]; j--) {
+			t = v[j]; v[j] = v[j - 1]; v[j - 1] = t;
+		}
+	return (n % 2) ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2;
+}
+
+FNR == 1 {
+	for (i = 1; i <= NF; i++)
+		col[$i] = i;
+	file++;
+	next;
+}
+
+{
+	key = $col["backend"] SUBSEP $col["trace"];
+	if (!(key in seen)) {
+		seen[key] = 1;
+		keys[++nkeys] = key;
+	}
+	rows[file, key]++;
+	if ($col["status"] != "ok")
+		next;
+	ran[file, key]++;
+	for (k = 1; k <= nmetrics; k++) {
+		name = metric[k];
+		if ((name in col) && $col[name] != "")
+			sample[file, key, name] = sample[file, key, name] " " $col[name];
+	}
+}
+
+BEGIN {
+	nmetrics = split(metrics, spec, " ");
+	for (k = 1; k <= nmetrics; k++) {
+		split(spec[k], md, ":");
+		metric[k] = md[1];
+		better[k] = md[2];
+	}
+	printf("%-14s %-10s %-14s %12s %12s %8s %8s\n",
+	       "backend", "trace", "metric", "baseline", "current", "change", "p");
+}
+
+END {
+	regressions = 0;
+	for (i = 1; i <= nkeys; i++) {
+		key = keys[i];
+		split(key, bt, SUBSEP);
+		if (ran[1, key] > 0 && rows[2, key] > 0 && ran[2, key] == 0) {
+			printf("%-14s %-10s %-14s %12s %12s %8s %8s  REGRESSION\n",
+			       bt[1], bt[2], "status", "ok", "fail", "", "");
+			regressions++;
+			continue;
+		}
+		for (k = 1; k <= nmetrics; k++) {
+			name = metric[k];
+			if (sample[1, key, name] == "" || sample[2, key, name] == "")
+				continue;
+
+			m = split(sample[1, key, name], base, " ");
+			n = split(sample[2, key, name], cur, " ");
+
+			# U counts the pairs where the current run is worse,
+			# ties count half
+			u = 0;
+			for (a = 1; a <= m; a++)
+				for (b = 1; b <= n; b++) {
+					if (cur[b] == base[a])
+						u += 0.5;
+					else if ((better[k] == "+") == (cur[b] < base[a]))
+						u++;
+				}
+			# rounding down keeps ties from looking significant
+			p = pvalue(m, n, int(u));
+
+			bmed = median(sample[1, key, name]);
+			cmed = median(sample[2, key, name]);
+			change = (bmed != 0) ? 100 * (cmed - bmed) / bmed : 0;
+			worse = (better[k] == "+") ? -change : change;
+
+			verdict = "";
+			if (worse > threshold && p < alpha) {
+				verdict = "  REGRESSION";
+				regressions++;
+			} else if (-worse > threshold &&
+				   pvalue(m, n, int(m * n - u)) < alpha) {
+				verdict = "  improved";
+			}
+			printf("%-14s %-10s %-14s %12g %12g %+7.1f%% %8.4f%s\n",
+			       bt[1], bt[2], name, bmed, cmed, change, p, verdict);
+		}
+	}
+	printf("%d regression(s), threshold %g%%, alpha %g\n",
+	       regressions, threshold, alpha);
+	exit (regressions > 0);
+}' "$1" "$2";
@@ -45,15 +45,40 @@
  ***************************************************************************/
 #define __KMA_TEST_IMPL__
 
+/* KMA_SIM ("make sim") only simulates placement: it is a competition
+ * build, so no block is written or checked, that keeps the allocation
+ * timeline of correctness mode. */
+#ifdef KMA_SIM
+#define COMPETITION
+#endif
+
 /************System include***********************************************/
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_trace.h"
+#include "kma_instr.h"
+#include "kma_stats.h"
+#include "kma_class.h"
+#include "kma_hist.h"
+#include "kma_frag.h"
+#ifdef KMA_TCACHE
+#include "kma_tcache.h"
+#endif
+#ifdef KMA_MAGAZINE
+#include "kma_magazine.h"
+#endif
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -72,19 +97,183 @@ typedef struct mem
 {
   int size;
   void* ptr;
-  void* value; // to check correctness
+  uint64_t seed; // pattern of the block, to check correctness
   enum REQ_STATE state;
 } mem_t;
 
+/* Multi-threaded replay (-t N). Every trace line may carry a thread id
+ * as its last column; lines without one go to thread (id % N). The ops
+ * are cut into epochs so that whenever an id was last touched by
+ * another thread, the two ops are separated by a barrier. */
+typedef struct op
+{
+  enum TRACE_OP type;
+  int id;
+  int size;
+  int thread;
+  int epoch;
+} op_t;
+
+/* Latencies of kma_malloc (TRACE_REQUEST) and kma_free (TRACE_FREE)
+ * per size class, the last class holds everything above MAXCLASSSIZE */
+#define LATCLASSES (NUMSIZECLASSES + 1)
+
+typedef struct worker
+{
+  pthread_t thread;
+  op_t** ops;
+  int n_ops;
+  kma_hist_t lat[2][LATCLASSES];
+} worker_t;
+
+/* Streaming replay (-s). Instead of a table indexed by id, the live
+ * requests are kept in an open-addressing hash map with linear probing
+ * that is at most half full. Memory follows the live set, and ids are
+ * not bounded by the trace header. */
+#define LIVE_EMPTY (-1L)
+#define LIVE_MINBITS 10
+
+typedef struct live
+{
+  long id;		// LIVE_EMPTY for an empty slot
+  mem_t mem;
+} live_t;
+
+// reusable barrier, pthread_barrier_t is not available everywhere
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int count;
+  int waiting;
+  int generation;
+} barrier_t;
+
+/* Correctness mode writes a pattern into every block instead of
+ * keeping a copy of it: 64-bit word i of a block is seed + i * PATTERNSTEP,
+ * with a fresh seed per allocation, so a block that is overwritten,
+ * moved or handed out twice no longer matches its own pattern. */
+#define PATTERNSTEP 0x9E3779B97F4A7C15ULL
+
+/* Allocation timeline of correctness mode, for kma_output.plt: samples
+ * of "op requested allocated", as text lines in kma_output.dat or with
+ * -B as three int64 in host byte order in kma_output.bin. They are
+ * collected in a buffer that is written out when full. -w N keeps every
+ * Nth op, -w change the ops that change the pages in use, -w off none. */
+#define TIMELINE_BUFSIZE (1 << 20)
+#define TIMELINE_CHANGE 0
+#define TIMELINE_OFF (-1)
+
+typedef struct
+{
+  FILE* file;
+  int used;
+  long last;		// allocated bytes of the last sample
+  char buf[TIMELINE_BUFSIZE];
+} timeline_t;
+
+/* Heap snapshots (-d N): after op N, the regions of kma_heap_walk()
+ * are written to kma_heap_N.dat as "page offset size state class"
+ * lines, and their totals per state to stdout. */
+#define MAXDUMPS 16
+#define REGIONSTATES (KMA_REGION_META + 1)
+
+typedef struct
+{
+  FILE* file;
+  long regions[REGIONSTATES];
+  size_t bytes[REGIONSTATES];
+  size_t largestFree;
+} heap_dump_t;
+
 /************Global Variables*********************************************/
 
-static int val = 0;
+#ifndef COMPETITION
+static uint64_t gSeed = 0;
+#endif
+
+static int gThreads = 1;
+static int gLatency = 0;
+static int gMemStats = 0;
+
+// -w and -B
+static int gTimelineEvery = 1;
+static int gTimelineBinary = 0;
+static timeline_t* gTimeline = NULL;
+
+// -d, in ascending order
+static long gDumps[MAXDUMPS];
+static int gNumDumps = 0;
+
+// -f: fragmentation every Nth op, 0 for off
+static int gFragEvery = 0;
+static FILE* gFragFile = NULL;
+static kma_frag_sum_t gFragSum;
+
+static const char* kRegionNames[REGIONSTATES] =
+  {
+    "used", "free", "cached", "meta"
+  };
+
+// -b: one summary line with the timing of the whole replay
+static int gSummary = 0;
+static long long gReplayOps = 0;
+static long long gReplayTime = 0;
+static kma_hist_t gAllLatency[2];	// per TRACE_REQUEST/TRACE_FREE
+
+static op_t* gOps = NULL;
+static int gNumOps = 0;
+static int gEpochs = 1;
+
+static barrier_t gBarrier;
+
+static mem_t* gMemRequests = NULL;
+
+static int gStream = 0;
+static live_t* gLive = NULL;
+static int gLiveBits = 0;
+static long gLiveCount = 0;
+
+// latencies of the calling replay thread, NULL if nothing is timed
+static __thread worker_t* gWorker = NULL;
+static worker_t gMainWorker;
+
+#ifndef KMA_FRONTEND
+// the plain backends are not thread-safe, -t serializes them
+static pthread_mutex_t gKmaLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /************Function Prototypes******************************************/
-void allocate();
-void deallocate();
-void fill(char*, int);
-void check(char*, char*, int);
+void allocate(mem_t*, int);
+void deallocate(mem_t*);
+live_t* liveInsert(long);
+live_t* liveFind(long);
+void liveRemove(live_t*);
+void liveGrow();
+unsigned long liveHash(long);
+void* timedMalloc(kma_size_t);
+void timedFree(void*, kma_size_t);
+int latClass(kma_size_t);
+void sumLatency(worker_t*, int, kma_hist_t*);
+void reportLatency(worker_t*, int);
+void freeLatency(worker_t*);
+void reportStats();
+void timelineOpen();
+void timelineRecord(long, long, long);
+void timelineClose();
+void addDump(long);
+void dumpHeap(long);
+void dumpRegion(kma_region_t*, void*);
+void fragSample(long);
+void reportSummary(kma_page_stat_t*, double, int);
+void addOp(enum TRACE_OP, int, int, int, int);
+void replayThreads(mem_t*, int);
+void* replay(void*);
+void barrierWait(barrier_t*);
+long long now();
+void fill(char*, int, uint64_t);
+void check(char*, int, uint64_t);
+uint64_t patternByte(uint64_t, int);
 void usage();
 void error(char*, char*);
 void pass();
@@ -98,7 +287,7 @@ void fail();
 
 int anyMismatches = 0;
 
-int currentAllocBytes = 0;
+long currentAllocBytes = 0;
 
 char *name = NULL;
 
@@ -108,7 +297,9 @@ main(int argc, char* argv[])
   
   name = argv[0];
   
-#ifdef COMPETITION
+#if defined(KMA_SIM)
+  printf("%s: Running in simulation mode\n", name);
+#elif defined(COMPETITION)
   printf("%s: Running in competition mode\n", name);
 #endif
 
@@ -116,107 +307,255 @@ main(int argc, char* argv[])
   printf("%s: Running in correctness mode\n", name);
 #endif
 
-  int n_req = 0, n_alloc=0, n_dealloc=0;
+  int n_req = 0;
+  long n_alloc = 0, n_dealloc = 0;
   kma_page_stat_t* stat;
 
-#ifdef COMPETITION
   double ratioSum = 0.0;
   int ratioCount = 0;
-#endif
+  long long start;
+  int nextDump = 0;
   
-#ifndef COMPETITION
-  FILE* allocTrace = fopen("kma_output.dat", "w");
-  if (allocTrace == NULL)
+  int opt;
+  while ((opt = getopt(argc, argv, "bBd:f:lmst:w:")) != -1)
     {
-      error("unable to open allocation output file", "kma_output.dat");
+      switch (opt)
+	{
+	case 'b':
+	  gSummary = 1;
+	  break;
+	case 'B':
+	  gTimelineBinary = 1;
+	  break;
+	case 'd':
+	  addDump(atol(optarg));
+	  break;
+	case 'f':
+	  if ((gFragEvery = atoi(optarg)) < 1)
+	    {
+	      usage();
+	    }
+	  break;
+	case 'l':
+	  gLatency = 1;
+	  break;
+	case 'm':
+	  gMemStats = 1;
+	  break;
+	case 's':
+	  gStream = 1;
+	  break;
+	case 't':
+	  gThreads = atoi(optarg);
+	  if (gThreads < 1)
+	    {
+	      usage();
+	    }
+	  break;
+	case 'w':
+	  if (strcmp(optarg, "change") == 0)
+	    {
+	      gTimelineEvery = TIMELINE_CHANGE;
+	    }
+	  else if (strcmp(optarg, "off") == 0)
+	    {
+	      gTimelineEvery = TIMELINE_OFF;
+	    }
+	  else if ((gTimelineEvery = atoi(optarg)) < 1)
+	    {
+	      usage();
+	    }
+	  break;
+	default:
+	  usage();
+	}
     }
-  fprintf(allocTrace, "0 0 0\n");
-#endif
 
-  if (argc != 2)
+  // -t hands the ops to the threads by id and needs the table, and
+  // has no single point in the trace to take a snapshot at
+  if (optind != argc - 1
+      || (gThreads > 1 && (gStream || gNumDumps > 0 || gFragEvery > 0)))
     {
       usage();
     }
-  
-  FILE* f_test = fopen(argv[1], "r");
-  if (f_test == NULL)
+
+  if (gFragEvery > 0)
     {
-      error("unable to open input test file", argv[1]);
+      gFragFile = fopen("kma_frag.dat", "w");
+      if (gFragFile == NULL)
+	{
+	  error("cannot write", "kma_frag.dat");
+	}
+      fprintf(gFragFile, "# op pages live internal meta external empty "
+	      "cached offpage largest index\n");
     }
+
+#if !defined(COMPETITION) || defined(KMA_SIM)
+  timelineOpen();
+#endif
+  
+  trace_t* trace = trace_open(argv[optind]);
   
   // Get the number of requests in the trace file
   // Allocate some memory...
-  int status = fscanf(f_test, "%d\n", &n_req);
-  if(status != 1)
-    error("Couldn't read number of requests at head of file", "");
+  n_req = trace_ids(trace);
   
-  mem_t* requests = malloc((n_req + 1)*sizeof(mem_t));
-  memset(requests, 0, (n_req + 1)*sizeof(mem_t));
+  mem_t* requests = NULL;
+  if (!gStream)
+    {
+      requests = malloc((n_req + 1)*sizeof(mem_t));
+      memset(requests, 0, (n_req + 1)*sizeof(mem_t));
+    }
   
-  char command[16];
-  int req_id, req_size, index = 1;
+  trace_op_t op;
+  live_t* live;
+  int req_id;
+  long index = 1;
 
-  // Parse the lines in the file, and call allocate or
-  // deallocate accordingly.
-  while (fscanf(f_test, "%10s", command) == 1)
+  if ((gLatency || gSummary) && gThreads == 1)
     {
-      if (strcmp(command, "REQUEST") == 0)
-	{
-	  
-	  if (fscanf(f_test, "%d %d", &req_id, &req_size) != 2)
-	    error("Not enough arguments to REQUEST", "");
-
-	  assert(req_id >= 0 && req_id < n_req);
-	  
-	  allocate(requests, req_id, req_size);
-	  n_alloc++;
-	}
-      else if (strcmp(command, "FREE") == 0)
+      gWorker = &gMainWorker;
+    }
+
+  start = now();
+
+  // Read the operations of the trace, and call allocate or
+  // deallocate accordingly. In -t mode the ops are only
+  // collected here and replayed afterwards.
+  while (trace_next(trace, &op))
+    {
+      if (gStream)
 	{
-	  if (fscanf(f_test, "%d", &req_id) != 1)
-	    error("Not enough arguments to FREE", "");
-	  
-	  assert(req_id >= 0 && req_id < n_req);
-	  
-	  deallocate(requests, req_id);
-	  n_dealloc++;
+	  if (op.type == TRACE_REQUEST)
+	    {
+	      live = liveInsert(op.id);
+	      allocate(&live->mem, op.size);
+	      if (live->mem.state == FREE)
+		{
+		  liveRemove(live);
+		}
+	      n_alloc++;
+	    }
+	  else
+	    {
+	      live = liveFind(op.id);
+	      if (live == NULL)
+		{
+		  error("FREE of a request that is not allocated", "");
+		}
+	      deallocate(&live->mem);
+	      liveRemove(live);
+	      n_dealloc++;
+	    }
 	}
       else
 	{
-	  error("unknown command type:", command);
+	  assert(op.id >= 0 && op.id < n_req);
+	  req_id = op.id;
+
+	  if (gThreads > 1)
+	    {
+	      addOp(op.type, req_id, op.size,
+		    (op.tid >= 0) ? op.tid : req_id, n_req);
+	      continue;
+	    }
+
+	  if (op.type == TRACE_REQUEST)
+	    {
+	      allocate(&requests[req_id], op.size);
+	      n_alloc++;
+	    }
+	  else
+	    {
+	      deallocate(&requests[req_id]);
+	      n_dealloc++;
+	    }
 	}
 
       stat = page_stats();
-      int totalBytes = stat->num_in_use * stat->page_size;
+      long totalBytes = (long) stat->num_in_use * stat->page_size;
 
       
-#ifdef COMPETITION
-      if(req_id < n_req && n_alloc != n_dealloc)
+      if(n_alloc != n_dealloc)
 	{
 	  // We can calculate the ratio of wasted to used memory here.
 
-	  int wastedBytes = totalBytes - currentAllocBytes;
+	  long wastedBytes = totalBytes - currentAllocBytes;
 	  ratioSum += ((double) wastedBytes) / currentAllocBytes;
 	  ratioCount += 1;
 	}
-#endif
 
-#ifndef COMPETITION
-      fprintf(allocTrace, "%d %d %d\n", index, currentAllocBytes, totalBytes);
+#if !defined(COMPETITION) || defined(KMA_SIM)
+      if (gTimeline != NULL)
+	{
+	  timelineRecord(index, currentAllocBytes, totalBytes);
+	}
 #endif
+
+      while (nextDump < gNumDumps && gDumps[nextDump] == index)
+	{
+	  dumpHeap(index);
+	  nextDump++;
+	}
+
+      if (gFragEvery > 0 && index % gFragEvery == 0)
+	{
+	  fragSample(index);
+	}
       
       index += 1;
     }
 
-#ifndef COMPETITION
-  fclose(allocTrace);
+#if !defined(COMPETITION) || defined(KMA_SIM)
+  timelineClose();
 #endif
+  trace_close(trace);
+  gReplayOps = n_alloc + n_dealloc;
+
+  if (gFragFile != NULL)
+    {
+      fclose(gFragFile);
+      frag_report(stdout, &gFragSum);
+    }
+  gReplayTime = now() - start;
+
+  if (gThreads > 1)
+    {
+      replayThreads(requests, n_req);
+    }
+  else if (gWorker != NULL)
+    {
+      if (gLatency)
+	{
+	  reportLatency(&gMainWorker, 1);
+	}
+      sumLatency(&gMainWorker, TRACE_REQUEST,
+		 &gAllLatency[TRACE_REQUEST]);
+      sumLatency(&gMainWorker, TRACE_FREE,
+		 &gAllLatency[TRACE_FREE]);
+      freeLatency(&gMainWorker);
+      gWorker = NULL;
+    }
+
+  // before the front ends hand their caches back
+  if (gMemStats)
+    {
+      reportStats();
+    }
   
+#ifdef KMA_TCACHE
+  // hand the cached blocks back before checking for leaked pages
+  kma_tcache_flush();
+#endif
+#ifdef KMA_MAGAZINE
+  kma_magazine_flush();
+#endif
   
   stat = page_stats();
   
   printf("Page Requested/Freed/In Use: %5d/%5d/%5d\n",
 	 stat->num_requested, stat->num_freed, stat->num_in_use);	
+  instr_report(stdout);
   
   if (stat->num_requested != stat->num_freed || stat->num_in_use != 0)
     {
@@ -229,8 +568,17 @@ main(int argc, char* argv[])
     }
 
 #ifdef COMPETITION
-  printf("Competition average ratio: %f\n", ratioSum / ratioCount);
+  // the ratio is sampled per op, which -t does not do
+  if (ratioCount > 0)
+    {
+      printf("Competition average ratio: %f\n", ratioSum / ratioCount);
+    }
 #endif
+
+  if (gSummary)
+    {
+      reportSummary(stat, ratioSum, ratioCount);
+    }
   
   pass();
   return 0;
@@ -252,7 +600,18 @@ pass()
 
 void
 usage() {
-  printf("Usage: %s traceFile\n", name);
+  printf("Usage: %s [-b] [-l] [-m] [-w every|change|off] [-B] [-d op]... "
+	 "[-f every] [-s | -t threads] traceFile\n", name);
+  printf("  -b  print a summary line for benchmarks (see bench.sh)\n");
+  printf("  -B  write the allocation timeline in binary (kma_output.bin)\n");
+  printf("  -d  dump the heap after an op to kma_heap_<op>.dat\n");
+  printf("  -f  fragmentation every Nth op to kma_frag.dat, and its means\n");
+  printf("  -l  report latency percentiles per op and size class\n");
+  printf("  -m  report the allocator's statistics (kma_stats)\n");
+  printf("  -s  stream, keep only the live requests in memory\n");
+  printf("  -t  replay on several threads\n");
+  printf("  -w  timeline sample: every Nth op (1), on page changes, or off\n");
+  printf("traceFile may be - for stdin, or .gz/.bz2/.xz/.zst\n");
   exit(0);
 }
 
@@ -263,18 +622,16 @@ error(char* message, char* arg ) {
 }
 
 void
-allocate(mem_t* requests, int req_id, int req_size)
+allocate(mem_t* new, int req_size)
 {
-  mem_t* new = &requests[req_id];
-  
   assert(new->state == FREE);
   
   new->size = req_size;
-  new->ptr = kma_malloc(new->size);
+  new->ptr = timedMalloc(new->size);
   
-  // Accept a NULL response in some cases... 
-  if(!(((new->ptr != NULL) && (new->size <= (PAGESIZE - sizeof(void*))))
-       || ((new->ptr == NULL) && (new->size > (PAGESIZE - sizeof(void*))))))
+  // Accept a NULL response only for requests larger than a page,
+  // allocators that span page runs may satisfy those as well
+  if((new->ptr == NULL) && (new->size <= (PAGESIZE - sizeof(void*))))
     {
       error("got NULL from kma_malloc for alloc'able request", "");
     }
@@ -284,33 +641,29 @@ allocate(mem_t* requests, int req_id, int req_size)
       return;
     }
 
-  currentAllocBytes += req_size;
+  __atomic_add_fetch(&currentAllocBytes, req_size, __ATOMIC_RELAXED);
   
 #ifndef COMPETITION
-  // Only run the actual memory accesses/copies/checks if we're
+  // Only run the actual memory accesses/checks if we're
   // testing for correctness.
   
-  new->value = malloc(new->size);
-  assert(new->value != NULL);
+  // a splitmix64 step, so that neighbouring requests get unrelated
+  // patterns
+  new->seed = __atomic_add_fetch(&gSeed, PATTERNSTEP, __ATOMIC_RELAXED);
+  new->seed = (new->seed ^ (new->seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  new->seed = (new->seed ^ (new->seed >> 27)) * 0x94D049BB133111EBULL;
+  new->seed ^= new->seed >> 31;
   
   // initialize memory
-  fill((char*)new->ptr, new->size);
-  
-  // copy the value for further reference
-  bcopy(new->ptr, new->value, new->size);
-  
-  check((char*)new->ptr, (char*)new->value, new->size);
-  
+  fill((char*)new->ptr, new->size, new->seed);
 #endif
 
   new->state = USED;
 }
 
 void
-deallocate(mem_t* requests, int req_id)
+deallocate(mem_t* cur)
 {
-  mem_t* cur = &requests[req_id];
-  
   assert(cur->state == USED);
   assert(cur->size > 0);
   
@@ -318,42 +671,827 @@ deallocate(mem_t* requests, int req_id)
   // Only run the memory checks if we're testing for correctness.
 
   // check memory
-  check((char*)cur->ptr, (char*)cur->value, cur->size);
-
-  // free memory
-  free(cur->value);
+  check((char*)cur->ptr, cur->size, cur->seed);
 #endif
 
-  kma_free(cur->ptr, cur->size);
+  timedFree(cur->ptr, cur->size);
 
-  currentAllocBytes -= cur->size;
+  __atomic_sub_fetch(&currentAllocBytes, cur->size, __ATOMIC_RELAXED);
   
   cur->state = FREE;
 }
 
+/* The pattern is written and compared 16 bytes at a time with SSE2,
+ * 8 bytes at a time otherwise. Blocks need not be aligned. */
 void
-fill(char* ptr, int size)
+fill(char* ptr, int size, uint64_t seed)
 {
-  int i;
+  uint64_t word = seed;
+  int i = 0;
   
-  for (i = 0; i < size; i++)
+#if defined(__SSE2__)
+  __m128i pattern = _mm_set_epi64x(seed + PATTERNSTEP, seed);
+  __m128i step = _mm_set1_epi64x(2 * PATTERNSTEP);
+  
+  for (; i + 16 <= size; i += 16)
+    {
+      _mm_storeu_si128((__m128i*) (ptr + i), pattern);
+      pattern = _mm_add_epi64(pattern, step);
+    }
+  word = seed + (i / 8) * PATTERNSTEP;
+#endif
+  for (; i + 8 <= size; i += 8)
     {
-      ptr[i] = (char) val++;
+      memcpy(ptr + i, &word, 8);
+      word += PATTERNSTEP;
     }
+  memcpy(ptr + i, &word, size - i);
 }
 
 void
-check(char* lhs, char* rhs, int size)
+check(char* ptr, int size, uint64_t seed)
 {
-  int i;
+  uint64_t word = seed;
+  uint64_t diff = 0;
+  uint64_t have;
+  char expect;
+  int i = 0;
   
+#if defined(__SSE2__)
+  __m128i pattern = _mm_set_epi64x(seed + PATTERNSTEP, seed);
+  __m128i step = _mm_set1_epi64x(2 * PATTERNSTEP);
+  __m128i diffs = _mm_setzero_si128();
+  
+  for (; i + 16 <= size; i += 16)
+    {
+      diffs = _mm_or_si128(diffs,
+			   _mm_xor_si128(_mm_loadu_si128((__m128i*) (ptr + i)),
+					 pattern));
+      pattern = _mm_add_epi64(pattern, step);
+    }
+  diff = _mm_movemask_epi8(_mm_cmpeq_epi8(diffs, _mm_setzero_si128()))
+    != 0xFFFF;
+  word = seed + (i / 8) * PATTERNSTEP;
+#endif
+  for (; i + 8 <= size; i += 8)
+    {
+      memcpy(&have, ptr + i, 8);
+      diff |= have ^ word;
+      word += PATTERNSTEP;
+    }
+  have = word;
+  memcpy(&have, ptr + i, size - i);
+  diff |= have ^ word;
+  
+  if (diff == 0)
+    {
+      return;
+    }
+  
+  // find the bytes that differ
   for (i = 0; i < size; i++)
     {
-      if (lhs[i] != rhs[i])
+      expect = (char) patternByte(seed, i);
+      if (ptr[i] != expect)
 	{
 	  fprintf(stderr, "memory mismatch at position %d (%3d!=%3d)\n", 
-		  i, lhs[i], rhs[i]);
+		  i, ptr[i], expect);
 	  anyMismatches = 1;
 	}
     }
 }
+
+uint64_t
+patternByte(uint64_t seed, int pos)
+{
+  uint64_t word = seed + (pos / 8) * PATTERNSTEP;
+  unsigned char bytes[8];
+  
+  memcpy(bytes, &word, 8);
+  return bytes[pos % 8];
+}
+
+void*
+timedMalloc(kma_size_t size)
+{
+  uint64_t start;
+  void* ptr;
+
+  if (gWorker == NULL)
+    {
+      return kma_malloc(size);
+    }
+
+  start = hist_ticks();
+#ifndef KMA_FRONTEND
+  if (gThreads > 1)
+    {
+      pthread_mutex_lock(&gKmaLock);
+      ptr = kma_malloc(size);
+      pthread_mutex_unlock(&gKmaLock);
+    }
+  else
+    {
+      ptr = kma_malloc(size);
+    }
+#else
+  ptr = kma_malloc(size);
+#endif
+  hist_record(&gWorker->lat[TRACE_REQUEST][latClass(size)],
+	      hist_ticks() - start);
+
+  return ptr;
+}
+
+void
+timedFree(void* ptr, kma_size_t size)
+{
+  uint64_t start;
+
+  if (gWorker == NULL)
+    {
+      kma_free(ptr, size);
+      return;
+    }
+
+  start = hist_ticks();
+#ifndef KMA_FRONTEND
+  if (gThreads > 1)
+    {
+      pthread_mutex_lock(&gKmaLock);
+      kma_free(ptr, size);
+      pthread_mutex_unlock(&gKmaLock);
+    }
+  else
+    {
+      kma_free(ptr, size);
+    }
+#else
+  kma_free(ptr, size);
+#endif
+  hist_record(&gWorker->lat[TRACE_FREE][latClass(size)],
+	      hist_ticks() - start);
+}
+
+int
+latClass(kma_size_t size)
+{
+  return (size > MAXCLASSSIZE) ? NUMSIZECLASSES : size_class(size);
+}
+
+void
+sumLatency(worker_t* w, int type, kma_hist_t* sum)
+{
+  int cls;
+
+  for (cls = 0; cls < LATCLASSES; cls++)
+    {
+      hist_merge(sum, &w->lat[type][cls]);
+    }
+}
+
+void
+reportLatency(worker_t* workers, int n)
+{
+  static char* kOpName[2] = { "malloc", "free" };
+  static double kFraction[4] = { 0.5, 0.9, 0.99, 0.999 };
+  kma_hist_t total;
+  kma_hist_t* hist;
+  char label[16];
+  int type, cls, t, i;
+
+  printf("Latency (ns)          count      p50      p90      p99    p99.9"
+	 "        max\n");
+
+  for (type = TRACE_REQUEST; type <= TRACE_FREE; type++)
+    {
+      // all sizes first, then every size class that was used
+      for (cls = -1; cls < LATCLASSES; cls++)
+	{
+	  memset(&total, 0, sizeof(total));
+	  for (t = 0; t < n; t++)
+	    {
+	      if (cls < 0)
+		{
+		  sumLatency(&workers[t], type, &total);
+		}
+	      else
+		{
+		  hist_merge(&total, &workers[t].lat[type][cls]);
+		}
+	    }
+	  hist = &total;
+	  if (hist->count == 0)
+	    {
+	      hist_free(hist);
+	      continue;
+	    }
+
+	  if (cls < 0)
+	    {
+	      sprintf(label, "all");
+	    }
+	  else if (cls == NUMSIZECLASSES)
+	    {
+	      sprintf(label, ">%d", MAXCLASSSIZE);
+	    }
+	  else
+	    {
+	      sprintf(label, "<=%d", class_size(cls));
+	    }
+
+	  printf("%-6s %-7s %12llu", kOpName[type], label,
+		 (unsigned long long) hist->count);
+	  for (i = 0; i < 4; i++)
+	    {
+	      printf(" %8.0f", hist_ns(hist_percentile(hist, kFraction[i])));
+	    }
+	  printf(" %10.0f\n", hist_ns(hist->max));
+	  hist_free(hist);
+	}
+    }
+}
+
+void
+freeLatency(worker_t* w)
+{
+  int type, cls;
+
+  for (type = TRACE_REQUEST; type <= TRACE_FREE; type++)
+    {
+      for (cls = 0; cls < LATCLASSES; cls++)
+	{
+	  hist_free(&w->lat[type][cls]);
+	}
+    }
+}
+
+void
+reportStats()
+{
+  kma_stats_t* stats = kma_stats();
+  int cls;
+
+  printf("Requests/Frees: %lu/%lu\n", stats->n_requests, stats->n_frees);
+  printf("Splits/Coalesces: %lu/%lu\n", stats->n_split, stats->n_coalesce);
+  printf("Bytes Requested/Live/Used/Meta/Held: %zu/%zu/%zu/%zu/%zu\n",
+	 stats->bytes_requested, stats->bytes_live, stats->bytes_used,
+	 stats->bytes_meta, stats->bytes_held);
+  printf("Pages In Use: %d\n", stats->pages);
+
+  printf("Requests per size class:");
+  for (cls = 0; cls < STATCLASSES; cls++)
+    {
+      if (stats->n_class[cls] == 0)
+	{
+	  continue;
+	}
+      if (cls == NUMSIZECLASSES)
+	{
+	  printf(" >%d:%lu", MAXCLASSSIZE, stats->n_class[cls]);
+	}
+      else
+	{
+	  printf(" <=%d:%lu", class_size(cls), stats->n_class[cls]);
+	}
+    }
+  printf("\n");
+}
+
+void
+timelineOpen()
+{
+  char* path = gTimelineBinary ? "kma_output.bin" : "kma_output.dat";
+
+  if (gTimelineEvery == TIMELINE_OFF)
+    {
+      return;
+    }
+
+  gTimeline = malloc(sizeof(timeline_t));
+  assert(gTimeline != NULL);
+  gTimeline->file = fopen(path, "w");
+  if (gTimeline->file == NULL)
+    {
+      error("unable to open allocation output file", path);
+    }
+  gTimeline->used = 0;
+  gTimeline->last = -1;
+
+  timelineRecord(0, 0, 0);
+}
+
+void
+timelineRecord(long index, long requested, long allocated)
+{
+  int64_t value[3] = { index, requested, allocated };
+  char digits[20];
+  char* out;
+  int i, n;
+
+  if (gTimelineEvery == TIMELINE_CHANGE)
+    {
+      if (allocated == gTimeline->last)
+	{
+	  return;
+	}
+    }
+  else if (index % gTimelineEvery != 0)
+    {
+      return;
+    }
+  gTimeline->last = allocated;
+
+  // room for the longest line
+  if (gTimeline->used + 3 * sizeof(digits) > TIMELINE_BUFSIZE)
+    {
+      fwrite(gTimeline->buf, 1, gTimeline->used, gTimeline->file);
+      gTimeline->used = 0;
+    }
+  out = gTimeline->buf + gTimeline->used;
+
+  if (gTimelineBinary)
+    {
+      memcpy(out, value, sizeof(value));
+      gTimeline->used += sizeof(value);
+      return;
+    }
+
+  // formats the numbers by hand, fprintf cost more than the replay
+  for (i = 0; i < 3; i++)
+    {
+      uint64_t v = (value[i] < 0) ? -value[i] : value[i];
+
+      n = 0;
+      do
+	{
+	  digits[n++] = '0' + v % 10;
+	  v /= 10;
+	}
+      while (v > 0);
+      if (value[i] < 0)
+	{
+	  *out++ = '-';
+	}
+      while (n > 0)
+	{
+	  *out++ = digits[--n];
+	}
+      *out++ = (i < 2) ? ' ' : '\n';
+    }
+  gTimeline->used = out - gTimeline->buf;
+}
+
+void
+timelineClose()
+{
+  if (gTimeline == NULL)
+    {
+      return;
+    }
+
+  fwrite(gTimeline->buf, 1, gTimeline->used, gTimeline->file);
+  fclose(gTimeline->file);
+  free(gTimeline);
+  gTimeline = NULL;
+}
+
+void
+addDump(long index)
+{
+  int i;
+
+  if (index < 1 || gNumDumps == MAXDUMPS)
+    {
+      usage();
+    }
+
+  for (i = gNumDumps; i > 0 && gDumps[i - 1] > index; i--)
+    {
+      gDumps[i] = gDumps[i - 1];
+    }
+  gDumps[i] = index;
+  gNumDumps++;
+}
+
+void
+dumpHeap(long index)
+{
+  heap_dump_t dump;
+  char path[64];
+  int state;
+
+  snprintf(path, sizeof(path), "kma_heap_%ld.dat", index);
+  memset(&dump, 0, sizeof(dump));
+  dump.file = fopen(path, "w");
+  if (dump.file == NULL)
+    {
+      error("cannot write the heap snapshot", path);
+    }
+
+  fprintf(dump.file, "# heap after op %ld\n# page offset size state class\n",
+	  index);
+  kma_heap_walk(dumpRegion, &dump);
+  fclose(dump.file);
+
+  printf("Heap after op %ld: %d pages,", index, page_stats()->num_in_use);
+  for (state = 0; state < REGIONSTATES; state++)
+    {
+      printf(" %s %zu bytes in %ld%s", kRegionNames[state],
+	     dump.bytes[state], dump.regions[state],
+	     (state < REGIONSTATES - 1) ? "," : "");
+    }
+  printf(", largest free %zu\n", dump.largestFree);
+}
+
+void
+dumpRegion(kma_region_t* region, void* arg)
+{
+  heap_dump_t* dump = (heap_dump_t*) arg;
+
+  fprintf(dump->file, "%d %ld %zu %s %d\n", region->page,
+	  (long)(region->addr - BASEADDR(region->addr)), region->size,
+	  kRegionNames[region->state], region->cls);
+
+  dump->regions[region->state]++;
+  dump->bytes[region->state] += region->size;
+  if (region->state == KMA_REGION_FREE && region->size > dump->largestFree)
+    {
+      dump->largestFree = region->size;
+    }
+}
+
+void
+fragSample(long index)
+{
+  kma_frag_t frag;
+
+  frag_measure(&frag);
+  frag_write(gFragFile, index, &frag);
+  frag_add(&gFragSum, &frag);
+}
+
+/* key=value pairs on one line, for bench.sh and perfcheck.sh. The
+ * percentiles are over all calls, with the p99 of mallocs and frees
+ * on their own as well. The ratio is only sampled in single-threaded
+ * replay and left out otherwise. */
+void
+reportSummary(kma_page_stat_t* stat, double ratioSum, int ratioCount)
+{
+  static double kFraction[4] = { 0.5, 0.9, 0.99, 0.999 };
+  static char* kName[4] = { "p50", "p90", "p99", "p999" };
+  kma_hist_t all = { 0, 0, 0, NULL };
+  int i;
+
+  hist_merge(&all, &gAllLatency[TRACE_REQUEST]);
+  hist_merge(&all, &gAllLatency[TRACE_FREE]);
+
+  printf("Summary: ops=%lld seconds=%.6f ops_per_sec=%.0f", gReplayOps,
+	 gReplayTime / 1e9,
+	 gReplayTime > 0 ? gReplayOps * 1e9 / gReplayTime : 0.0);
+  for (i = 0; i < 4; i++)
+    {
+      printf(" %s_ns=%.0f", kName[i],
+	     hist_ns(hist_percentile(&all, kFraction[i])));
+    }
+  printf(" max_ns=%.0f malloc_p99_ns=%.0f free_p99_ns=%.0f",
+	 hist_ns(all.max),
+	 hist_ns(hist_percentile(&gAllLatency[TRACE_REQUEST], 0.99)),
+	 hist_ns(hist_percentile(&gAllLatency[TRACE_FREE], 0.99)));
+  printf(" peak_pages=%d", stat->num_peak);
+  if (ratioCount > 0)
+    {
+      printf(" waste_ratio=%f", ratioSum / ratioCount);
+    }
+  printf(" pages_requested=%d pages_freed=%d\n", stat->num_requested,
+	 stat->num_freed);
+  hist_free(&all);
+}
+
+live_t*
+liveInsert(long id)
+{
+  unsigned long mask;
+  unsigned long i;
+
+  if (id < 0)
+    {
+      error("negative request id", "");
+    }
+
+  if (2 * (gLiveCount + 1) > (1L << gLiveBits))
+    {
+      liveGrow();
+    }
+
+  mask = (1UL << gLiveBits) - 1;
+  for (i = liveHash(id); gLive[i].id != LIVE_EMPTY; i = (i + 1) & mask)
+    {
+      if (gLive[i].id == id)
+	{
+	  error("REQUEST of a request that is already allocated", "");
+	}
+    }
+
+  memset(&gLive[i], 0, sizeof(live_t));
+  gLive[i].id = id;
+  gLiveCount++;
+
+  return &gLive[i];
+}
+
+live_t*
+liveFind(long id)
+{
+  unsigned long mask;
+  unsigned long i;
+
+  if (gLive == NULL)
+    {
+      return NULL;
+    }
+
+  mask = (1UL << gLiveBits) - 1;
+  for (i = liveHash(id); gLive[i].id != LIVE_EMPTY; i = (i + 1) & mask)
+    {
+      if (gLive[i].id == id)
+	{
+	  return &gLive[i];
+	}
+    }
+
+  return NULL;
+}
+
+void
+liveRemove(live_t* live)
+{
+  unsigned long mask = (1UL << gLiveBits) - 1;
+  unsigned long hole = live - gLive;
+  unsigned long i, home;
+
+  // shift the following entries back, so no tombstones are needed
+  for (i = (hole + 1) & mask; gLive[i].id != LIVE_EMPTY; i = (i + 1) & mask)
+    {
+      home = liveHash(gLive[i].id);
+      if (((i - home) & mask) >= ((i - hole) & mask))
+	{
+	  gLive[hole] = gLive[i];
+	  hole = i;
+	}
+    }
+
+  gLive[hole].id = LIVE_EMPTY;
+  gLiveCount--;
+}
+
+void
+liveGrow()
+{
+  live_t* old = gLive;
+  long oldSize = old ? (1L << gLiveBits) : 0;
+  unsigned long mask;
+  unsigned long i;
+  long j;
+
+  gLiveBits = old ? gLiveBits + 1 : LIVE_MINBITS;
+  gLive = malloc((1L << gLiveBits) * sizeof(live_t));
+  assert(gLive != NULL);
+  for (j = 0; j < (1L << gLiveBits); j++)
+    {
+      gLive[j].id = LIVE_EMPTY;
+    }
+
+  mask = (1UL << gLiveBits) - 1;
+  for (j = 0; j < oldSize; j++)
+    {
+      if (old[j].id != LIVE_EMPTY)
+	{
+	  for (i = liveHash(old[j].id); gLive[i].id != LIVE_EMPTY;
+	       i = (i + 1) & mask)
+	    ;
+	  gLive[i] = old[j];
+	}
+    }
+
+  free(old);
+}
+
+unsigned long
+liveHash(long id)
+{
+  // Fibonacci hashing, the top bits are the best mixed
+  return ((unsigned long) id * 0x9E3779B97F4A7C15UL) >> (64 - gLiveBits);
+}
+
+void
+addOp(enum TRACE_OP type, int req_id, int req_size, int tid, int n_req)
+{
+  // thread and epoch that last touched every id
+  static int* lastThread = NULL;
+  static int* lastEpoch = NULL;
+  static int capacity = 0;
+  op_t* op;
+  int i;
+
+  if (lastThread == NULL)
+    {
+      lastThread = malloc(n_req * sizeof(int));
+      lastEpoch = malloc(n_req * sizeof(int));
+      assert(lastThread != NULL && lastEpoch != NULL);
+      for (i = 0; i < n_req; i++)
+	{
+	  lastEpoch[i] = -1;
+	}
+    }
+
+  if (gNumOps == capacity)
+    {
+      capacity = (capacity == 0) ? 1024 : capacity * 2;
+      gOps = realloc(gOps, capacity * sizeof(op_t));
+      assert(gOps != NULL);
+    }
+
+  op = &gOps[gNumOps++];
+  op->type = type;
+  op->id = req_id;
+  op->size = req_size;
+  op->thread = tid % gThreads;
+
+  // another thread used this id in the current epoch, start a new
+  // one so the barrier orders the two
+  if (lastEpoch[req_id] == gEpochs - 1 && lastThread[req_id] != op->thread)
+    {
+      gEpochs++;
+    }
+  op->epoch = gEpochs - 1;
+
+  lastThread[req_id] = op->thread;
+  lastEpoch[req_id] = op->epoch;
+}
+
+void
+replayThreads(mem_t* requests, int n_req)
+{
+  worker_t* workers = calloc(gThreads, sizeof(worker_t));
+  long long start, elapsed, ops = 0;
+  kma_hist_t lat;
+  worker_t* w;
+  int i, t;
+
+  assert(workers != NULL);
+
+  // hand every thread its own ops, in trace order
+  for (i = 0; i < gNumOps; i++)
+    {
+      workers[gOps[i].thread].n_ops++;
+    }
+  for (t = 0; t < gThreads; t++)
+    {
+      workers[t].ops = malloc((workers[t].n_ops + 1) * sizeof(op_t*));
+      assert(workers[t].ops != NULL);
+      workers[t].n_ops = 0;
+    }
+  for (i = 0; i < gNumOps; i++)
+    {
+      w = &workers[gOps[i].thread];
+      w->ops[w->n_ops++] = &gOps[i];
+    }
+
+  pthread_mutex_init(&gBarrier.lock, NULL);
+  pthread_cond_init(&gBarrier.cond, NULL);
+  gBarrier.count = gThreads;
+
+  gMemRequests = requests;
+
+  start = now();
+  for (t = 0; t < gThreads; t++)
+    {
+      if (pthread_create(&workers[t].thread, NULL, replay, &workers[t]) != 0)
+	{
+	  error("unable to create replay thread", "");
+	}
+    }
+  for (t = 0; t < gThreads; t++)
+    {
+      pthread_join(workers[t].thread, NULL);
+    }
+  elapsed = now() - start;
+
+  printf("Threads: %d, epochs: %d\n", gThreads, gEpochs);
+  for (t = 0; t < gThreads; t++)
+    {
+      w = &workers[t];
+      printf("Thread %3d:", t);
+
+      memset(&lat, 0, sizeof(lat));
+      sumLatency(w, TRACE_REQUEST, &lat);
+      printf(" %8llu mallocs avg %7.0f ns max %9.0f ns,",
+	     (unsigned long long) lat.count,
+	     lat.count ? hist_ns(lat.total) / lat.count : 0.0,
+	     hist_ns(lat.max));
+      ops += lat.count;
+      hist_free(&lat);
+
+      sumLatency(w, TRACE_FREE, &lat);
+      printf(" %8llu frees avg %7.0f ns max %9.0f ns\n",
+	     (unsigned long long) lat.count,
+	     lat.count ? hist_ns(lat.total) / lat.count : 0.0,
+	     hist_ns(lat.max));
+      ops += lat.count;
+      hist_free(&lat);
+
+      free(w->ops);
+    }
+  printf("Throughput: %lld ops in %.3f s, %.0f ops/sec\n", ops,
+	 elapsed / 1e9, elapsed > 0 ? ops * 1e9 / elapsed : 0.0);
+  gReplayOps = ops;
+  gReplayTime = elapsed;
+
+  if (gLatency)
+    {
+      reportLatency(workers, gThreads);
+    }
+  for (t = 0; t < gThreads; t++)
+    {
+      sumLatency(&workers[t], TRACE_REQUEST,
+		 &gAllLatency[TRACE_REQUEST]);
+      sumLatency(&workers[t], TRACE_FREE, &gAllLatency[TRACE_FREE]);
+      freeLatency(&workers[t]);
+    }
+
+  free(workers);
+  free(gOps);
+}
+
+void*
+replay(void* arg)
+{
+  worker_t* w = (worker_t*) arg;
+  int epoch = 0;
+  op_t* op;
+  int i;
+
+  gWorker = w;
+
+  for (i = 0; i < w->n_ops; i++)
+    {
+      op = w->ops[i];
+      while (epoch < op->epoch)
+	{
+	  barrierWait(&gBarrier);
+	  epoch++;
+	}
+
+      if (op->type == TRACE_REQUEST)
+	{
+	  allocate(&gMemRequests[op->id], op->size);
+	}
+      else
+	{
+	  deallocate(&gMemRequests[op->id]);
+	}
+    }
+
+  // every thread passes every barrier
+  while (epoch < gEpochs - 1)
+    {
+      barrierWait(&gBarrier);
+      epoch++;
+    }
+
+  gWorker = NULL;
+  return NULL;
+}
+
+void
+barrierWait(barrier_t* barrier)
+{
+  int generation;
+
+  pthread_mutex_lock(&barrier->lock);
+  generation = barrier->generation;
+  if (++barrier->waiting == barrier->count)
+    {
+      barrier->waiting = 0;
+      barrier->generation++;
+      pthread_cond_broadcast(&barrier->cond);
+    }
+  else
+    {
+      while (generation == barrier->generation)
+	{
+	  pthread_cond_wait(&barrier->cond, &barrier->lock);
+	}
+    }
+  pthread_mutex_unlock(&barrier->lock);
+}
+
+long long
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -65,6 +65,26 @@
 
 typedef int kma_size_t;
 
+/* A thread-safe front end (see kma_tcache.h and kma_magazine.h) can
+ * be put in front of any backend. The backend's kma_malloc/kma_free
+ * (and kma_stats/kma_heap_walk, see kma_stats.h) are then renamed to
+ * kma_backend_malloc/kma_backend_free and only called by the front
+ * end, with the backend lock held. */
+#if defined(KMA_TCACHE) && defined(KMA_MAGAZINE)
+#error "KMA_TCACHE and KMA_MAGAZINE are alternative front ends"
+#endif
+
+#if defined(KMA_TCACHE) || defined(KMA_MAGAZINE)
+#define KMA_FRONTEND
+#endif
+
+#if defined(KMA_FRONTEND) && defined(__KMA_IMPL__)
+#define kma_malloc kma_backend_malloc
+#define kma_free kma_backend_free
+#define kma_stats kma_backend_stats
+#define kma_heap_walk kma_backend_heap_walk
+#endif
+
 /************Global Variables*********************************************/
 
 /************Function Prototypes******************************************/
@@ -91,6 +111,11 @@ EXTERN void* kma_malloc(kma_size_t size);
  ***********************************************************************/
 EXTERN void kma_free(void*, kma_size_t size);
 
+#ifdef KMA_FRONTEND
+void* kma_backend_malloc(kma_size_t size);
+void kma_backend_free(void*, kma_size_t size);
+#endif
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
@@ -45,10 +45,14 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#ifdef KMA_SIM
+#include <sys/mman.h>
+#endif
 
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_instr.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -58,15 +62,37 @@
  */
 
 /************Global Variables*********************************************/
-static kma_page_stat_t kma_page_stats = { 0, 0, 0, PAGESIZE };
+static kma_page_stat_t kma_page_stats = { 0, 0, 0, PAGESIZE, 0 };
 
 static void* pool = NULL;
-static void* next_free_page = NULL;
+
+// free page runs form one list per order, linked by the number of
+// their first page, so that the pages themselves are never written
+typedef struct
+{
+  int next;
+  int prev;
+} page_run_t;
+
+// first page of a free run of each order, -1 if none
+static int free_runs[MAXPAGEORDER + 1];
+
+// page_table(), the links of the free run starting at each page
+static page_run_t* runs = NULL;
+
+// order of the free run starting at each page, -1 if none starts there
+static signed char run_order[MAXPAGES];
+
+// order of the allocated run starting at each page, -1 if none does
+static signed char used_order[MAXPAGES];
 
 /************Function Prototypes******************************************/
-void* allocPage();
-void freePage(void*);
+void* allocPage(int);
+void freePage(void*, int);
 void initPages();
+int pageOrder(int);
+void pushRun(int, int);
+void removeRun(int);
 
 /************External Declaration*****************************************/
 
@@ -74,35 +100,58 @@ void initPages();
 
 kma_page_t*
 get_page()
+{
+  return get_pages(1);
+}
+
+kma_page_t*
+get_pages(int count)
 {
   static int id = 0;
   kma_page_t* res;
+  int order;
+  INSTR_START(start);
   
-  kma_page_stats.num_requested++;
-  kma_page_stats.num_in_use++;
+  assert(count > 0 && count <= MAXPAGES);
+  
+  order = pageOrder(count);
+  
+  kma_page_stats.num_requested += 1 << order;
+  kma_page_stats.num_in_use += 1 << order;
+  if (kma_page_stats.num_in_use > kma_page_stats.num_peak)
+    {
+      kma_page_stats.num_peak = kma_page_stats.num_in_use;
+    }
   
   res = (kma_page_t*) malloc(sizeof(kma_page_t));
   res->id = id++;
-  res->size = kma_page_stats.page_size;
-  res->ptr = allocPage();
+  res->size = kma_page_stats.page_size << order;
+  res->ptr = allocPage(order);
   
   assert(res->ptr != NULL);
   
+  INSTR_END(KMA_EV_PAGE_GET, start);
   return res;	
 }
 
 void
 free_page(kma_page_t* ptr)
 {
+  int count;
+  INSTR_START(start);
+  
   assert(ptr != NULL);
   assert(ptr->ptr != NULL);
-  assert(kma_page_stats.num_in_use > 0);
   
-  kma_page_stats.num_freed++;
-  kma_page_stats.num_in_use--;
+  count = ptr->size / kma_page_stats.page_size;
+  assert(kma_page_stats.num_in_use >= count);
   
-  freePage(ptr->ptr);
+  kma_page_stats.num_freed += count;
+  kma_page_stats.num_in_use -= count;
+  
+  freePage(ptr->ptr, pageOrder(count));
   free(ptr);
+  INSTR_END(KMA_EV_PAGE_PUT, start);
 }
 
 kma_page_stat_t*
@@ -113,43 +162,188 @@ page_stats()
   return memcpy(&stats, &kma_page_stats, sizeof(kma_page_stat_t));
 }
 
+int
+page_index(void* ptr)
+{
+  assert(pool != NULL);
+  assert(ptr >= pool && ptr < pool + POOLSIZE);
+  
+  return (BASEADDR(ptr) - pool) / PAGESIZE;
+}
+
+void
+page_walk(kma_page_walk_fn fn, void* arg)
+{
+  int index = 0;
+  
+  if (pool == NULL)
+    {
+      return;
+    }
+  
+  // free and allocated runs tile the pool
+  while (index < MAXPAGES)
+    {
+      if (used_order[index] >= 0)
+	{
+	  fn(pool + (size_t) index * PAGESIZE, 1 << used_order[index], arg);
+	  index += 1 << used_order[index];
+	}
+      else
+	{
+	  assert(run_order[index] >= 0);
+	  index += 1 << run_order[index];
+	}
+    }
+}
+
 void*
-allocPage()
+page_table(size_t size)
+{
+  void* table;
+
+#ifdef KMA_SIM
+  table = mmap(NULL, MAXPAGES * size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (table == MAP_FAILED)
+    {
+      error("Error using mmap to reserve a page table", "");
+    }
+#else
+  table = calloc(MAXPAGES, size);
+  if (table == NULL)
+    {
+      error("Error using calloc to allocate a page table", "");
+    }
+#endif
+  return table;
+}
+
+int
+pageOrder(int count)
 {
-  void* res;
+  int order = 0;
+  
+  while ((1 << order) < count)
+    {
+      order++;
+    }
+  
+  return order;
+}
+
+void
+pushRun(int index, int order)
+{
+  page_run_t* run = &runs[index];
+  
+  run->prev = -1;
+  run->next = free_runs[order];
+  if (run->next >= 0)
+    {
+      runs[run->next].prev = index;
+    }
+  free_runs[order] = index;
+  run_order[index] = order;
+}
+
+void
+removeRun(int index)
+{
+  page_run_t* run = &runs[index];
+  int order = run_order[index];
+  
+  if (run->prev >= 0)
+    {
+      runs[run->prev].next = run->next;
+    }
+  else
+    {
+      free_runs[order] = run->next;
+    }
+  if (run->next >= 0)
+    {
+      runs[run->next].prev = run->prev;
+    }
+  run_order[index] = -1;
+}
+
+void*
+allocPage(int order)
+{
+  int found, index;
   
   if (pool == NULL)
     {
       initPages();
     }
   
-  res = next_free_page;
+  // smallest free run that is large enough
+  for (found = order; found <= MAXPAGEORDER; found++)
+    {
+      if (free_runs[found] >= 0)
+	{
+	  break;
+	}
+    }
   
-  if (res == NULL)
+  if (found > MAXPAGEORDER)
     {
       error("error: all pages already allocated", "");
     }
   
-  next_free_page = *((void**)next_free_page);
+  index = free_runs[found];
+  removeRun(index);
   
-  assert(res != NULL);
+  // split it, handing the upper halves back as buddies
+  while (found > order)
+    {
+      found--;
+      pushRun(index + (1 << found), found);
+    }
+  used_order[index] = order;
   
-  return res;
+  return pool + (size_t) index * PAGESIZE;
 }
 
 void
-freePage(void* ptr)
+freePage(void* ptr, int order)
 {
+  int index, buddy;
+  
   assert(ptr != NULL);
   
-  *((void**)ptr) = next_free_page;
-  next_free_page = ptr;
+  index = (ptr - pool) / PAGESIZE;
+  assert((index & ((1 << order) - 1)) == 0);
+  assert(used_order[index] == order);
+  used_order[index] = -1;
+  
+  // merge with the buddy run for as long as it is free and whole
+  while (order < MAXPAGEORDER)
+    {
+      buddy = index ^ (1 << order);
+      if (run_order[buddy] != order)
+	{
+	  break;
+	}
+      removeRun(buddy);
+      if (buddy < index)
+	{
+	  index = buddy;
+	}
+      order++;
+    }
+  
+  pushRun(index, order);
   
   if (kma_page_stats.num_in_use == 0)
     {
+#ifdef KMA_SIM
+      munmap(pool, POOLSIZE);
+#else
       free(pool);
+#endif
       pool = NULL;
-      next_free_page = NULL;
     }
 }
 
@@ -158,23 +352,37 @@ initPages()
 {
   int i;
   
-  assert(next_free_page == NULL);
   assert(pool == NULL);
+  assert((1 << MAXPAGEORDER) == MAXPAGES);
   
+#ifdef KMA_SIM
+  // address space only: a page gets memory if the allocator writes
+  // into it, the page layer itself keeps out of the pages
+  pool = mmap(NULL, POOLSIZE, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (pool == MAP_FAILED)
+    {
+      pool = NULL;
+      error("Error using mmap to reserve the page pool", "");
+    }
+#else
   //pool = calloc(MAXPAGES, PAGESIZE);
-  int result = posix_memalign(&pool, PAGESIZE, MAXPAGES * PAGESIZE);
+  int result = posix_memalign(&pool, PAGESIZE, POOLSIZE);
   if(result)
     error("Error using posix_memalign to allocate memory", "");
-  next_free_page = pool;
+#endif
   
-  // use ptr to point to the next free page struct
-  for (i = 0; i < (MAXPAGES - 1); i++)
+  if (runs == NULL)
+    {
+      runs = page_table(sizeof(page_run_t));
+    }
+  for (i = 0; i <= MAXPAGEORDER; i++)
     {
-      void* ptr = (pool + i * PAGESIZE);
-      void* next = ptr + PAGESIZE;
-      
-      *((void**) ptr) = next;
+      free_runs[i] = -1;
     }
+  memset(run_order, -1, sizeof(run_order));
+  memset(used_order, -1, sizeof(used_order));
   
-  *((void**)(pool + (MAXPAGES - 1) * PAGESIZE)) = NULL;
+  // the whole pool starts out as a single free run
+  pushRun(0, MAXPAGEORDER);
 }